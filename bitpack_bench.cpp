@@ -0,0 +1,130 @@
+/*
+Micro benchmark of the BitPusher row packing, against the historical
+one call per pixel path. Checks every kernel gives the very same bytes.
+
+  bitpack_bench [rows]
+*/
+#include "flatconvert.h"
+#include "stdlib.h"
+#include "chrono"
+
+#define BENCH_WIDTH_MAX 96 // glyph rows are short
+#define BENCH_PASSES    5  // best of
+
+/**
+ * Gray rows looking like rendered glyphs : mostly black or white, some edges
+ * 1 bpp rows are packed, as FreeType gives them
+ */
+class Rows
+{
+public:
+    Rows(int nb, int bpp)
+    {
+        srand(1234);
+        pitch=BENCH_WIDTH_MAX;
+        data.resize(nb*pitch);
+        for(int i=0;i<nb;i++)
+        {
+            int w=1+rand()%BENCH_WIDTH_MAX;
+            widths.push_back(w);
+            uint8_t *line=data.data()+i*pitch;
+            for(int x=0;x<w;x++)
+            {
+                int r=rand()%8;
+                line[x]= r<3 ? 0 : r<6 ? 255 : rand()&0xFF;
+            }
+            if(bpp==1)
+            {
+                std::vector<uint8_t> packed((w+7)/8,0);
+                for(int x=0;x<w;x++)
+                    if(line[x]&0x80) packed[x>>3]|=0x80>>(x&7);
+                memset(line,0,pitch);
+                memcpy(line,packed.data(),packed.size());
+            }
+        }
+    }
+    int                   pitch;
+    std::vector<int>      widths;
+    std::vector<uint8_t>  data;
+};
+
+/**
+ * What convert1bit/convertNbit used to do
+ */
+static void perPixel(BitPusher &p, const uint8_t *line, int width, int bpp)
+{
+    for(int x=0;x<width;x++)
+    {
+        switch(bpp)
+        {
+            case 1: p.addBit(line[x/8]&(0x80>>(x&7)));break;
+            case 2:
+            {
+                int pix=(line[x]+31)>>6;
+                if(pix>3) pix=3;
+                p.add2Bits(pix);
+            }
+            break;
+            case 4: p.add4Bits(line[x]>>4);break;
+            case 8: p.add8Bits(line[x]);break;
+        }
+    }
+}
+
+/**
+ * Run all the rows through one path, best time of a few passes
+ * @return pixels per microsecond
+ */
+static double run(const Rows &rows, int bpp, const PackKernels *kernels, std::vector<uint8_t> &out)
+{
+    double best=1e30;
+    int64_t pixels=0;
+    for(int pass=0;pass<BENCH_PASSES;pass++)
+    {
+        BitPusher p;
+        pixels=0;
+        auto start=std::chrono::steady_clock::now();
+        for(int i=0;i<(int)rows.widths.size();i++)
+        {
+            const uint8_t *line=rows.data.data()+i*rows.pitch;
+            if(kernels) p.addRow(line,rows.widths[i],bpp,*kernels);
+            else        perPixel(p,line,rows.widths[i],bpp);
+            pixels+=rows.widths[i];
+        }
+        p.align();
+        double us=std::chrono::duration<double,std::micro>(std::chrono::steady_clock::now()-start).count();
+        if(us<best) best=us;
+        out.assign(p.data(),p.data()+p.offset());
+    }
+    return pixels/best;
+}
+
+int main(int argc, char **argv)
+{
+    int nbRows=argc>1 ? atoi(argv[1]) : 200000;
+    int nbKernels;
+    const PackKernels *kernels=allPackKernels(nbKernels);
+    printf("%d rows of 1..%d pixels, selected kernel : %s\n",nbRows,BENCH_WIDTH_MAX,packKernels().name);
+    printf("bpp  path         Mpixel/s  speedup  output\n");
+    int failed=0;
+    const int bpps[]={1,2,4,8};
+    for(int b=0;b<4;b++)
+    {
+        int bpp=bpps[b];
+        Rows rows(nbRows,bpp);
+        std::vector<uint8_t> reference,out;
+        double base=run(rows,bpp,NULL,reference);
+        printf("%d    per pixel   %9.1f     1.00\n",bpp,base);
+        // 1 and 8 bpp do not use the kernels, only the shifting
+        int nb=(bpp==1 || bpp==8) ? 1 : nbKernels;
+        for(int k=0;k<nb;k++)
+        {
+            double speed=run(rows,bpp,kernels+k,out);
+            bool same=out==reference;
+            if(!same) failed++;
+            printf("%d    %-10s  %9.1f  %7.2f  %s\n",bpp,(bpp==1 || bpp==8) ? "row" : kernels[k].name,
+                   speed,speed/base,same ? "identical" : "DIFFERENT");
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -16,8 +16,11 @@ Keep 7-bit fonts around as an option in that case, more compact.
 
 See notes at end for glyph nomenclature & other tidbits.
 */
-#include "flatconvert.h"
+#include "libflatconvert.h"
 #include "cxxopts.hpp"
+#include "thread"
+#include "errno.h"
+#include "limits.h"
 
 /**
  * 
@@ -28,6 +31,296 @@ void usage()
     exit(1);
 }
 
+enum FcOptionKind
+{
+  FC_OPTION_BOOL,
+  FC_OPTION_INT,
+  FC_OPTION_STRING,
+};
+/**
+ * All the command line options : declared to cxxopts, and used by the server
+ * to check the command line of its clients before handing it to cxxopts
+ */
+struct FcOption
+{
+  const char    *names;        // "s,size" or "size"
+  FcOptionKind  kind;
+  const char    *defaultValue; // NULL : none
+  const char    *help;
+};
+static const FcOption fcOptions[]=
+{
+  {"f,font",         FC_OPTION_STRING,  NULL,        "font to use"},
+  {"s,size",         FC_OPTION_INT,     "0",         "font size"},
+  {"sizes",          FC_OPTION_STRING,  "",          "several sizes in the same file, e.g. 12,16,20"},
+  {"bpps",           FC_OPTION_STRING,  "",          "several bit per pixel in the same file, e.g. 1,4"},
+  {"k,pick",         FC_OPTION_STRING,  "",          "UTF-8 string with chars to use"},
+  {"corpus",         FC_OPTION_STRING,  "",          "comma separated UTF-8 files, the chars they use are picked"},
+  {"corpus_freq",    FC_OPTION_STRING,  "",          "write how often each char of the corpus is used to that file"},
+  {"b,begin_char",   FC_OPTION_INT,     "32",        "first glyph"},
+  {"e,end_char",     FC_OPTION_INT,     "127",       "last glyph"},
+  {"o,output_file",  FC_OPTION_STRING,  "",          "output file"},
+  {"m,bitmap_file",  FC_OPTION_STRING,  "",          "bitmap binaryfile"},
+  {"blob_file",      FC_OPTION_STRING,  "",          "whole font as one memory-mappable binary blob, see pfxblob.h"},
+  {"p,bpp",          FC_OPTION_INT,     "1",         "bit per pixel (1,2 or 4)"},
+  {"c,compression",  FC_OPTION_BOOL,    "false",     "compress with heatshrink"},
+  {"d,dictionary",   FC_OPTION_BOOL,    "false",     "compress against a dictionary built from the font"},
+  {"a,adaptive",     FC_OPTION_BOOL,    "false",     "store each glyph raw, RLE or compressed, whichever is smallest"},
+  {"z,dedup",        FC_OPTION_BOOL,    "false",     "store identical glyph bitmaps only once"},
+  {"cache",          FC_OPTION_STRING,  "",          "directory keeping rendered glyphs between runs"},
+  {"format",         FC_OPTION_STRING,  "gray",      "gray, ssd1306 (OLED pages), rgb565 or rgb332 : glyphs stored the way the display takes them"},
+  {"fg",             FC_OPTION_STRING,  "0xFFFFFF",  "rgb formats, text colour 0xRRGGBB"},
+  {"bg",             FC_OPTION_STRING,  "0x000000",  "rgb formats, background colour 0xRRGGBB"},
+  {"trim",           FC_OPTION_BOOL,    "false",     "crop the blank edges of each glyph"},
+  {"trim_rows",      FC_OPTION_BOOL,    "false",     "trim, and leave out the longest run of blank rows inside each glyph"},
+  {"atlas",          FC_OPTION_INT,     "0",         "atlas pages of that width (pixels) instead of a bitmap, see pfxatlas.h"},
+  {"atlas_height",   FC_OPTION_INT,     "0",         "atlas page height, 0 : one page as high as needed"},
+  {"atlas_align",    FC_OPTION_INT,     "16",        "atlas row stride alignment in bytes"},
+  {"kerning",        FC_OPTION_BOOL,    "false",     "emit the kerning pairs of the font (pfxKerning)"},
+  {"stream",         FC_OPTION_BOOL,    "false",     "write the glyphs as they are converted, memory does not grow with the glyph count"},
+  {"rotate",         FC_OPTION_INT,     "0",         "glyphs pre-rotated clockwise for rotated panels : 0, 90, 180 or 270"},
+  {"incbin",         FC_OPTION_BOOL,    "false",     "bitmap pulled from the bitmap file with .incbin instead of a C array"},
+  {"hs_window",      FC_OPTION_INT,     "8",         "heatshrink window bits"},
+  {"hs_lookahead",   FC_OPTION_INT,     "4",         "heatshrink lookahead bits"},
+  {"hs_search",      FC_OPTION_BOOL,    "false",     "try all heatshrink window/lookahead, keep the smallest"},
+  {"hs_ram",         FC_OPTION_INT,     "0",         "max decoder RAM (window+input buffer) in bytes, limits hs_search or checks hs_window"},
+  {"batch",          FC_OPTION_STRING,  "",          "manifest file, one conversion per line"},
+  {"j,jobs",         FC_OPTION_INT,     "0",         "number of parallel jobs in batch mode (0=all cores)"},
+  {"u,sparse",       FC_OPTION_BOOL,    "false",     "sparse glyph index (code point runs), automatic above 0xFFFF"},
+  {"t,threads",      FC_OPTION_INT,     "0",         "number of threads rendering the glyphs (0=all cores)"},
+  {"stats",          FC_OPTION_STRING,  "",          "write phase timings, peak memory and per glyph sizes to that JSON file"},
+  {"serve",          FC_OPTION_STRING,  "",          "run as a conversion server listening on that Unix socket"},
+  {"serve_cache_mb", FC_OPTION_INT,     "256",       "memory the server keeps parsed fonts in, MB"},
+  {"server",         FC_OPTION_STRING,  "",          "have the server on that socket do the conversion (default : $FLATCONVERT_SERVER)"},
+};
+#define FC_NB_OPTIONS (int)(sizeof(fcOptions)/sizeof(fcOptions[0]))
+
+/**
+ * Declare the table to cxxopts
+ * @param options
+ */
+static void declareOptions(cxxopts::Options &options)
+{
+  auto adder=options.add_options();
+  for(int i=0;i<FC_NB_OPTIONS;i++)
+  {
+    const FcOption &o=fcOptions[i];
+    std::shared_ptr<cxxopts::Value> value;
+    switch(o.kind)
+    {
+      case FC_OPTION_BOOL:   value=cxxopts::value<bool>();break;
+      case FC_OPTION_INT:    value=cxxopts::value<int>();break;
+      case FC_OPTION_STRING: value=cxxopts::value<std::string>();break;
+    }
+    if(o.defaultValue)
+      value->default_value(o.defaultValue);
+    adder(o.names,o.help,value);
+  }
+}
+/**
+ * Command line => job
+ * @param result
+ * @param job
+ * @param error
+ * @return false if a value is invalid
+ */
+static bool fillJob(const cxxopts::ParseResult &result, FontJob &job, std::string &error)
+{
+    job.first = result["begin_char"].as<int>();
+    job.last = result["end_char"].as<int>();
+    job.size=result["size"].as<int>();
+    job.bpp=result["bpp"].as<int>();
+    if(result["sizes"].as<std::string>().size() && !parseIntList(result["sizes"].as<std::string>(),job.sizes))
+    {
+        error="invalid size list";
+        return false;
+    }
+    if(result["bpps"].as<std::string>().size() && !parseIntList(result["bpps"].as<std::string>(),job.bpps))
+    {
+        error="invalid bpp list";
+        return false;
+    }
+    job.pick=result["pick"].as<std::string>();
+    if(result["corpus"].as<std::string>().size() && !parseFileList(result["corpus"].as<std::string>(),job.corpusFiles))
+    {
+        error="invalid corpus file list";
+        return false;
+    }
+    job.frequencyFile=result["corpus_freq"].as<std::string>();
+    job.statsFile=result["stats"].as<std::string>();
+    job.fontFile=result["font"].as<std::string>();
+    job.outputFile=result["output_file"].as<std::string>();
+    job.bitmapFile=result["bitmap_file"].as<std::string>();  
+    job.blobFile=result["blob_file"].as<std::string>();
+    job.compression=result["compression"].as<bool>();  
+    job.threads=result["threads"].as<int>();
+    job.sparse=result["sparse"].as<bool>();
+    job.dictionary=result["dictionary"].as<bool>();
+    job.adaptive=result["adaptive"].as<bool>();
+    job.dedup=result["dedup"].as<bool>();
+    job.incbin=result["incbin"].as<bool>();
+    job.cacheDir=result["cache"].as<std::string>();
+    job.rotation=result["rotate"].as<int>();
+    job.atlasWidth=result["atlas"].as<int>();
+    job.atlasHeight=result["atlas_height"].as<int>();
+    job.atlasAlign=result["atlas_align"].as<int>();
+    job.kerning=result["kerning"].as<bool>();
+    job.stream=result["stream"].as<bool>();
+    job.trim=result["trim"].as<bool>();
+    job.trimGaps=result["trim_rows"].as<bool>();
+    if(!parseFormat(result["format"].as<std::string>(),job.format))
+    {
+        error="invalid format";
+        return false;
+    }
+    if(!parseColor(result["fg"].as<std::string>(),job.fgColor) || !parseColor(result["bg"].as<std::string>(),job.bgColor))
+    {
+        error="invalid colour";
+        return false;
+    }
+    job.hsWindow=result["hs_window"].as<int>();
+    job.hsLookahead=result["hs_lookahead"].as<int>();
+    job.hsSearch=result["hs_search"].as<bool>();
+    job.hsRamBudget=result["hs_ram"].as<int>();
+    if(job.threads<=0) job.threads=std::thread::hardware_concurrency();
+    return true;
+}
+/**
+ * Find an option of the table by its short or long name
+ * @param name
+ * @param isShort
+ * @return NULL if unknown
+ */
+static const FcOption *findOption(const std::string &name, bool isShort)
+{
+  for(int i=0;i<FC_NB_OPTIONS;i++)
+  {
+    std::string names=fcOptions[i].names;
+    std::string::size_type comma=names.find(',');
+    std::string shortName=comma==std::string::npos ? "" : names.substr(0,comma);
+    std::string longName=comma==std::string::npos ? names : names.substr(comma+1);
+    if(name==(isShort ? shortName : longName))
+      return fcOptions+i;
+  }
+  return NULL;
+}
+/**
+ * Would cxxopts take that value ? Integers are decimal or 0x hexadecimal
+ * @param o
+ * @param value
+ * @return
+ */
+static bool validValue(const FcOption &o, const std::string &value)
+{
+  switch(o.kind)
+  {
+    case FC_OPTION_BOOL:
+      return value=="true" || value=="false" || value=="1" || value=="0";
+    case FC_OPTION_INT:
+    {
+      const char *p=value.c_str();
+      if(*p=='-') p++;
+      if(!*p || !isdigit(*p)) return false;
+      errno=0;
+      char *end;
+      long long v=strtoll(value.c_str(),&end,0);
+      return !*end && !errno && v>=INT_MIN && v<=INT_MAX;
+    }
+    case FC_OPTION_STRING:
+      return true;
+  }
+  return false;
+}
+/**
+ * The server cannot trust what a client sends, and cxxopts built without
+ * exceptions exits on a parse error : check the command line against the
+ * option table first. Stricter than cxxopts, no positional argument
+ * @param args without the program name
+ * @param error
+ * @return false if cxxopts could reject it
+ */
+static bool checkClientArgs(const std::vector<std::string> &args, std::string &error)
+{
+  for(int i=0;i<(int)args.size();i++)
+  {
+    const std::string &a=args[i];
+    const FcOption *o=NULL;
+    std::string value;
+    bool hasValue=false;
+    if(a.size()>2 && a[0]=='-' && a[1]=='-')
+    {
+      std::string name=a.substr(2);
+      std::string::size_type eq=name.find('=');
+      if(eq!=std::string::npos)
+      {
+        value=name.substr(eq+1);
+        name=name.substr(0,eq);
+        hasValue=true;
+      }
+      o=findOption(name,false);
+    }else if(a.size()>=2 && a[0]=='-' && a[1]!='-')
+    {
+      o=findOption(a.substr(1,1),true);
+      if(o && a.size()>2)
+      {
+        if(o->kind==FC_OPTION_BOOL)
+        {
+          error="grouped short options are not supported : "+a;
+          return false;
+        }
+        value=a.substr(2);
+        hasValue=true;
+      }
+    }
+    if(!o)
+    {
+      error="unknown option "+a;
+      return false;
+    }
+    if(!hasValue && o->kind!=FC_OPTION_BOOL)
+    {
+      if(i+1>=(int)args.size())
+      {
+        error="missing value for "+a;
+        return false;
+      }
+      value=args[++i];
+      hasValue=true;
+    }
+    if(hasValue && !validValue(*o,value))
+    {
+      error="invalid value for "+a;
+      return false;
+    }
+  }
+  return true;
+}
+/**
+ * Server side : the command line a client sent, checked before cxxopts sees it
+ * @param args without the program name
+ * @param job
+ * @param error
+ * @return false with FC_ERROR_PARAMETERS as the job status
+ */
+static bool parseClientArgs(const std::vector<std::string> &args, FontJob &job, std::string &error)
+{
+    if(!checkClientArgs(args,error))
+    {
+        job.status=FC_ERROR_PARAMETERS;
+        return false;
+    }
+    cxxopts::Options options("flatconvert", "conversion server");
+    declareOptions(options);
+    std::vector<char *> argv;
+    argv.push_back((char *)"flatconvert");
+    for(int i=0;i<(int)args.size();i++)
+        argv.push_back((char *)args[i].c_str());
+    int argc=argv.size();
+    char **pargv=argv.data();
+    cxxopts::ParseResult result=options.parse(argc,pargv);
+    return fillJob(result,job,error);
+}
+
 /**
  * 
  * @param argc
@@ -37,105 +330,84 @@ void usage()
 int main(int argc, char *argv[]) 
 {
     printf("Usage:  flatconver -s size -f fontToUse (-o output file] [-b first char] [-e last char] [-p bpp (1,2 or 4)] [-c heatshrink compress]\n");
+    printf("        flatconver --batch manifest [-j jobs]\n");
+    printf("        flatconver --serve socket [--serve_cache_mb MB], then flatconver --server socket ... or FLATCONVERT_SERVER=socket flatconver ...\n");
     
     cxxopts::Options options("fatconvert", "cleaner version of adafruit fontconvert, ttf to GFXfont");
-  
-  options.add_options()
-    ("f,font",          "font to use",  cxxopts::value<std::string>()) // a bool parameter
-    ("s,size",          "font size",    cxxopts::value<int>())
-    ("k,pick",          "string with chars to use",  cxxopts::value<std::string>()->default_value(""))
-    ("b,begin_char",    "first glyph",  cxxopts::value<int>()->default_value("32"))
-    ("e,end_char",      "last glyph",   cxxopts::value<int>()->default_value("127")) // ~
-    ("o,output_file",   "output file",  cxxopts::value<std::string>())
-    ("m,bitmap_file",   "bitmap binaryfile",  cxxopts::value<std::string>()->default_value(""))
-    ("p,bpp",           "bit per pixel (1,2 or 4)",  cxxopts::value<int>()->default_value("1"))
-    ("c,compression",   "compress with heatshrink",  cxxopts::value<bool>()->default_value("false"))
-  
-    ;
+    declareOptions(options);
+    std::vector<std::string> args(argv+1,argv+argc); // as given, for the server
    cxxopts::ParseResult result;
    result = options.parse(argc, argv);
-   
-   int first = result["begin_char"].as<int>();
-   int last = result["end_char"].as<int>();
-   int size=result["size"].as<int>();
-   int bpp=result["bpp"].as<int>();
-   std::string pick=result["pick"].as<std::string>();
-   std::string fontFile=result["font"].as<std::string>();
-   std::string outputFile=result["output_file"].as<std::string>();
-   std::string bitmapFile=result["bitmap_file"].as<std::string>();  
-   bool compression=result["compression"].as<bool>();  
-      
-  std::string fileName = fontFile.substr(fontFile.find_last_of("/\\") + 1);
-  fileName= std::regex_replace(fileName, std::regex(" "), "_");  
-  fileName= std::regex_replace(fileName, std::regex("-"), "_");  
-  std::string::size_type const p(fileName.find_last_of('.'));
-  fileName = fileName.substr(0, p);
-  
-  
-  char ext[16];
-  sprintf(ext, "%dpt%db", size, (last > 127) ? 8 : 7);
-  
-  // full var name
-  std::string symbolName=fileName+std::string(ext);
 
-  if(!outputFile.size())
+   std::string serve=result["serve"].as<std::string>();
+   if(serve.size())
+       return runServer(serve,result["serve_cache_mb"].as<int>(),parseClientArgs);
+   
+   std::string manifest=result["batch"].as<std::string>();
+   if(manifest.size())
+   {
+       std::vector<FontJob> jobs;
+       if(!loadManifest(manifest,jobs))
+       {
+           printf("Invalid manifest %s\n",manifest.c_str());
+           exit(1);
+       }
+       int nbThreads=result["jobs"].as<int>();
+       if(nbThreads<=0) nbThreads=std::thread::hardware_concurrency();
+       printf("Running %d jobs on %d threads\n",(int)jobs.size(),nbThreads);
+       int failed=runBatch(jobs,nbThreads);
+       printf("\nDone.\n");
+       return failed ? 1 : 0;
+   }
+   
+   FontJob job;
+  std::string error;
+  if(!fillJob(result,job,error))
   {
-      outputFile=symbolName+std::string(".h");
+      printf("Invalid parameters : %s\n",error.c_str());
+      exit(FC_ERROR_PARAMETERS);
   }
- 
-  int mapp[255];
-  for(int i=0;i<128;i++) mapp[i]=0;
-  if(pick.size())
+  std::string server=result["server"].as<std::string>();
+  if(!server.size() && getenv("FLATCONVERT_SERVER"))
+      server=getenv("FLATCONVERT_SERVER");
+  if(server.size())
   {
-        int l=pick.size();    
-        const char *x=pick.c_str();
-        for(int i=0;i<l;i++)
-        {
-            mapp[x[i]]=1;
-        }
-        
-        for(int i=0;i<127;i++) if(mapp[i]) { first=i;break;}
-        for(int i=127;i>=0;i--) if(mapp[i]) { last=i;break;}
-  }else
+      int status;
+      if(runClient(server,args,status))
+      {
+          if(status==FC_OK) printf("\nDone.\n");
+          return status;
+      }
+      printf("No server on %s, converting here\n",server.c_str());
+  }
+  if(!job.prepare(error))
   {
-        for(int i=first;i<=last;i++) mapp[i]=1;
+      printf("Invalid parameters : %s\n",error.c_str());
+      exit(job.status);
   }
-
   
-  printf("Processing font %s\n",fontFile.c_str());
-  printf("Generating symbol %s\n",symbolName.c_str());
-  printf("Writing file %s\n",outputFile.c_str());
-  printf("First glyph  : %d '%c'\n",first,FontConverter::printable(first));
-  printf("Last glyph   : %d '%c'\n",last,FontConverter::printable(last));
-
-  FontConverter *converter=new FontConverter(fontFile,symbolName,outputFile);
-  
-  if(!converter->init(size,bpp,first,last,mapp))
+  printf("Processing font %s\n",job.fontFile.c_str());
+  for(int s=0;s<(int)job.sizes.size();s++)
+    for(int b=0;b<(int)job.bpps.size();b++)
+      printf("Generating symbol %s\n",job.variantSymbol(job.sizes[s],job.bpps[b]).c_str());
+  printf("Writing file %s\n",job.outputFile.c_str());
+  printf("First glyph  : %d '%s'\n",job.first,FontConverter::printable(job.first).c_str());
+  printf("Last glyph   : %d '%s'\n",job.last,FontConverter::printable(job.last).c_str());
+  printf("Glyphs       : %d\n",(int)job.codePoints.size());
+  if(job.compression)
   {
-      printf("Failed to init converter\n");
-      exit(1);
+      printf("Enabling compression\n");
   }
-  if(compression)
+  if(job.dictionary)
   {
-      printf("Enabling compression\n");
-      converter->enableCompression();
+      printf("Enabling dictionary compression\n");
   }
-  
-  if(!converter->convert())
+
+  if(!job.run(error))
   {
-      printf("Failed to convert\n");
-      exit(1);
+      printf("Failed (%s) : %s\n",fcStatusName(job.status),error.c_str());
+      exit(job.status);
   } 
-  converter->printHeader();
-  converter->printBitmap();
-  converter->printIndex();
-  converter->printFooter();
-  if(bitmapFile.size())
-  {
-      converter->saveBitmap(bitmapFile.c_str());
-  }  
-  delete converter;
-  converter=NULL;  
   printf("\nDone.\n");
   return 0;
 }
@@ -22,16 +22,96 @@ See notes at end for glyph nomenclature & other tidbits.
 #include <stdint.h>
 #include <stdio.h>
 #include FT_GLYPH_H
+#include FT_SIZES_H
 #include FT_MODULE_H
 #include FT_TRUETYPE_DRIVER_H
 #include "pfxfont.h" // Adafruit_GFX font structures
+#include "pfxrender.h"
+#include "pfxblob.h"
+#include "pfxatlas.h"
 #include "string"
 #include "regex"
 #include "vector"
-#define FC_BUFFER_SIZE (256*1024)
+#include "functional"
+#include "map"
+#include "memory"
+#include "list"
+#include "mutex"
+#include "atomic"
+#include "chrono"
+#include "string.h"
+#define FC_BUFFER_SIZE (64*1024) // initial bitmap buffer size, it grows as needed
+#define FC_EMIT_CHUNK (64*1024) // C arrays are formatted in memory and written by chunks of that size
+#ifndef FC_INCBIN_SECTION
+#define FC_INCBIN_SECTION ".rodata" // where --incbin puts the bitmap
+#endif
+#define FC_MAX_BLOCK_SHIFT 8 // large fonts : at most 256 glyphs share an offset base
 #define DPI 141 // Approximate res. of Adafruit 2.8" TFT
+#define FC_MAX_CODEPOINT 0x10FFFF
+#define FC_MAX_SPARSE_GLYPHS 0xFFFF // PFXrange::glyphIndex & PFXfont::nbRanges are 16 bits
+#define FC_HS_WINDOW    8 // default heatshrink parameters, the decoder must use the same
+#define FC_HS_LOOKAHEAD 4
+#define FC_HS_SEARCH_MIN_WINDOW 5 // parameter search range
+#define FC_HS_SEARCH_MAX_WINDOW 12
+#define FC_HS_SEARCH_MAX_LOOKAHEAD 8
+#define FC_HS_INPUT_BUFFER 32 // heatshrink decoder input buffer, counted in its RAM usage
+#define FC_HS_MAX_CHAIN 256 // match candidates tried per position by the dictionary encoder
+#define FC_DICTIONARY_SIZE 256 // and never more than the window
+#define FC_DICTIONARY_SEGMENT 16 // dictionary is built from chunks of that size
+// Rough Cortex-M0 cost of the reference decoder, for the size/speed estimate in the footer
+#define FC_CYCLES_PER_BIT   4
+#define FC_CYCLES_PER_BYTE  6
+#define FC_CYCLES_PER_TOKEN 10
+#define FC_CYCLES_PER_PIXEL 3  // unpacking & testing one pixel when drawing
+#define FC_CYCLES_PER_WRITE 8  // storing one pixel in the framebuffer
+#define FC_ATLAS_PADDING 1   // blank pixels between atlas glyphs
+#define FC_ATLAS_ALIGN   16  // default atlas row alignment, bytes
+#define FC_KERNING_MAX_GLYPHS 4096 // every pair is asked to FreeType, above that kerning is skipped
+#define FC_CORPUS_CHUNK (1024*1024) // corpus files are read by chunks of that size
+#define FC_FACE_OVERHEAD (64*1024) // FreeType memory per sized face, for the server face cache budget
+#define FC_MIN_GLYPHS_PER_THREAD 16 // below that, an extra thread costs more than it saves
+#define FC_STREAM_WINDOW 256 // --stream : glyphs rendered ahead of the one being written
+
+/// Milliseconds since start, for the phase timings
+static inline double fcElapsedMs(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-start).count();
+}
+
+/// Big endian 64 bits access, the bitmap is MSB first
+static inline uint64_t fcLoad64be(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v,p,8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v=__builtin_bswap64(v);
+#endif
+    return v;
+}
+static inline void fcStore64be(uint8_t *p, uint64_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v=__builtin_bswap64(v);
+#endif
+    memcpy(p,&v,8);
+}
+
 /**
- * 
+ * Row packing kernels : width pixels of 8 bits gray in, bpp packed pixels out, MSB first
+ * The last byte is zero padded
+ */
+typedef void (*PackRowFn)(const uint8_t *in, int width, uint8_t *out);
+class PackKernels
+{
+public:
+    const char  *name;
+    PackRowFn   pack2;
+    PackRowFn   pack4;
+};
+const PackKernels &packKernels(); // best one for this cpu, FC_PACK_KERNEL=name forces one
+const PackKernels *allPackKernels(int &nb);
+/**
+ * Packs pixels MSB first, the buffer grows as needed
  */
 class BitPusher
 {
@@ -40,19 +120,29 @@ public:
     {
         acc=0;
         bit=7;
-        cur=buffer;
+        cur=0;
+        buffer.resize(FC_BUFFER_SIZE);
     }
-    const uint8_t *data() {return buffer;}
+    const uint8_t *data() {return buffer.data();}
     void swallow(int nb, const uint8_t *d)
     {
-        memcpy(buffer,d,nb);
-        cur=buffer+nb;
+        cur=0;
+        reserve(nb);
+        memcpy(buffer.data(),d,nb);
+        cur=nb;
         bit=7;
         acc=0;
     }
+    void addBytes(int nb, const uint8_t *d)
+    {
+        reserve(nb);
+        memcpy(buffer.data()+cur,d,nb);
+        cur+=nb;
+    }
     void add8Bits(int val)
     {
-       *cur++=val;
+       reserve(1);
+       buffer[cur++]=val;
     }
     void add4Bits(int val)
     {
@@ -86,26 +176,330 @@ public:
             align();
         }
     }
+    /**
+     * Up to 8 bits, MSB first
+     */
+    void addBits(int val, int nb)
+    {
+        int room=bit+1;
+        if(nb<=room)
+        {
+            acc|=val<<(room-nb);
+            bit-=nb;
+            if(bit<0) align();
+            return;
+        }
+        int left=nb-room;
+        acc|=val>>left;
+        bit=-1;
+        align();
+        acc=(val&((1<<left)-1))<<(8-left);
+        bit-=left;
+    }
+    /**
+     * nbBits bits already packed MSB first, e.g. a FreeType mono row
+     * When not byte aligned, source bytes are shifted in 64 bits at a time
+     */
+    void addPacked(const uint8_t *src, int nbBits)
+    {
+        int nbBytes=nbBits>>3;
+        int rem=nbBits&7;
+        int pending=7-bit; // bits waiting in acc
+        reserve(nbBytes+1);
+        uint8_t *out=buffer.data()+cur;
+        if(!pending)
+        {
+            memcpy(out,src,nbBytes);
+        }else
+        {
+            int i=0;
+            for(;i+8<=nbBytes;i+=8)
+            {
+                uint64_t v=fcLoad64be(src+i);
+                fcStore64be(out+i,((uint64_t)acc<<56)|(v>>pending));
+                acc=(uint8_t)(v<<(8-pending));
+            }
+            for(;i<nbBytes;i++)
+            {
+                out[i]=acc|(src[i]>>pending);
+                acc=(uint8_t)(src[i]<<(8-pending));
+            }
+        }
+        cur+=nbBytes;
+        if(rem)
+            addBits(src[nbBytes]>>(8-rem),rem);
+    }
+    void addRow(const uint8_t *gray, int width, int bpp, const PackKernels &kernels=packKernels());
     void    align()
     {
         if(bit==7) return;
-        *cur=acc;
+        reserve(1);
+        buffer[cur]=acc;
         acc=0;
         cur++;
         bit=7;
     }
     int  offset()
     {
-        return (int)(cur-buffer);
+        return cur;
     }
     void setOffset(int of)
     {
-        cur=buffer+of;
+        cur=0;
+        reserve(of);
+        cur=of;
+    }
+    void reserve(int nb)
+    {
+        if(cur+nb<=(int)buffer.size()) return;
+        int sz=2*buffer.size();
+        if(sz<cur+nb) sz=cur+nb;
+        buffer.resize(sz);
     }
     int    bit;    
     int    acc;
-    uint8_t *cur;
-    uint8_t buffer[FC_BUFFER_SIZE];
+    int    cur;
+    std::vector<uint8_t> buffer;
+    std::vector<uint8_t> row; // addRow scratch
+};
+
+/**
+ * A glyph once rendered, packed and compressed, but not yet placed in the bitmap
+ */
+class EncodedGlyph
+{
+public:
+    EncodedGlyph()
+    {
+        clear();
+    }
+    /**
+     * Back to a blank glyph, the buffers keep their memory for the next one
+     */
+    void clear()
+    {
+        rendered=false;
+        rawSize=0;
+        renderedBytes=0;
+        gapStart=gapLength=0;
+        loadMs=0;
+        renderMs=0;
+        packMs=0;
+        compressMs=0;
+        glyph=(PFXglyph){0,0,0,0,0,0,0};
+        raw.clear();
+        data.clear();
+    }
+    bool                 rendered;
+    PFXglyph             glyph;     // bitmapOffset is set when assembling
+    int                  rawSize;   // size before compression
+    int                  renderedBytes; // FreeType bitmap
+    int                  gapStart,gapLength; // blank rows left out of raw, see PFX_GLYPH_ROW_GAP
+    double               loadMs,renderMs,packMs; // FT_Load_Char, the rest of the rendering, packing
+    double               compressMs; // streaming only, compression is a separate pass otherwise
+    std::vector<uint8_t> raw;       // before compression
+    std::vector<uint8_t> data;
+};
+
+/**
+ * One glyph as converted, --stats only
+ */
+class GlyphStats
+{
+public:
+    uint32_t    code;
+    int         width,height;
+    int         inked;         // non blank pixels, -1 for display formats
+    int         rawBytes;      // packed
+    int         storedBytes;   // as stored, row gap header included
+    const char *encoding;      // raw, rle, heatshrink, dictionary
+    bool        shared;        // dedup : same bytes as an earlier glyph
+    bool        cached;        // from the glyph cache, not rendered
+    double      loadMs,renderMs,packMs;
+};
+
+/**
+ * Where the time goes, and how many bytes come out of each phase
+ * render & pack are summed over all the threads
+ */
+class ConversionStats
+{
+public:
+    ConversionStats()
+    {
+        size=bpp=nbGlyphs=0;
+        initMs=loadMs=glyphLoadMs=renderMs=packMs=compressMs=emitMs=0;
+        renderBytes=packBytes=compressBytes=emitBytes=0;
+        peakKb=0;
+    }
+    std::string symbol;
+    int         size,bpp,nbGlyphs;
+    double      initMs;        // FreeType library init, part of loadMs
+    double      loadMs;        // FreeType init & face loading, all the faces
+    double      glyphLoadMs;   // FT_Load_Char
+    double      renderMs,packMs,compressMs,emitMs;
+    int64_t     renderBytes;   // FreeType bitmaps
+    int64_t     packBytes;     // packed glyphs
+    int64_t     compressBytes; // bitmap as stored
+    int64_t     emitBytes;     // output file
+    int64_t     peakKb;        // process peak resident memory once converted
+    std::vector<GlyphStats> glyphs; // only with enableGlyphStats()
+};
+
+/**
+ * Little endian writer for the blob & the glyph cache, section() pads to 4 bytes
+ */
+class BlobWriter
+{
+public:
+    void u8(int v)       {data.push_back((uint8_t)v);}
+    void u16(int v)      {u8(v);u8(v>>8);}
+    void u32(uint32_t v) {u16(v&0xFFFF);u16(v>>16);}
+    void bytes(const uint8_t *d, int nb) {data.insert(data.end(),d,d+nb);}
+    uint32_t section()
+    {
+        while(data.size()&3) data.push_back(0);
+        return data.size();
+    }
+    void set32(int at, uint32_t v)
+    {
+        for(int i=0;i<4;i++) data[at+i]=(v>>(8*i))&0xFF;
+    }
+    std::vector<uint8_t> data;
+};
+
+/**
+ * And the reader, reading past the end sets failed and returns 0
+ */
+class BlobReader
+{
+public:
+    BlobReader(const std::vector<uint8_t> &d) : data(d) {at=0;failed=false;}
+    bool     has(int nb)   {if(at+nb>(int)data.size()) failed=true; return !failed;}
+    int      u8()          {if(!has(1)) return 0; return data[at++];}
+    int      u16()         {int v=u8(); return v|(u8()<<8);}
+    uint32_t u32()         {uint32_t v=u16(); return v|((uint32_t)u16()<<16);}
+    const uint8_t *bytes(int nb) {if(nb<0 || !has(nb)) return NULL; at+=nb; return data.data()+at-nb;}
+    const std::vector<uint8_t> &data;
+    int      at;
+    bool     failed;
+};
+
+/**
+ * Server side : FacePools kept between requests, the least recently used
+ * being dropped when over the memory budget. A pool is taken out while a
+ * job uses it, two jobs on the same font at once get a pool each.
+ * Pools are keyed on the font path, size and date so that an edited font
+ * is loaded again
+ */
+class FacePool;
+class FaceCache
+{
+public:
+                        FaceCache(int64_t budget);
+                        ~FaceCache();
+        FacePool        *take(const std::string &fontFile);
+        void            give(FacePool *pool);
+        int             hits,misses;
+protected:
+        class Entry
+        {
+        public:
+            std::string key;
+            FacePool    *pool;
+            int64_t     cost;
+        };
+        static std::string fontKey(const std::string &fontFile);
+        std::mutex      lock;
+        std::list<Entry> entries; // most recently used first
+        int64_t         budget,used;
+};
+
+/**
+ * Rendered glyphs kept on disk between runs, one file per font content, size,
+ * dpi, bpp, hinting mode and load target. Only what FreeType produced is cached, the
+ * compression is redone every time since it depends on the whole glyph set
+ */
+class GlyphCache
+{
+public:
+                        GlyphCache();
+        bool            open(const std::string &dir, const std::string &fontFile, FT_Library library, int size, int bpp, int loadTarget, int rotation=0);
+        bool            lookup(uint32_t code, EncodedGlyph &out);
+        void            store(uint32_t code, const EncodedGlyph &e);
+        bool            save();
+        int             hits,misses;
+protected:
+        bool            load();
+        std::string     file;
+        uint64_t        fontHash;
+        bool            dirty;
+        std::map<uint32_t,EncodedGlyph> entries;
+};
+
+/**
+ * Code points used by a set of UTF-8 text files (string tables, sources...)
+ * and how often, see --corpus. Files are read by chunks, a sequence cut
+ * by the end of a chunk is finished with the next one. Invalid bytes are
+ * skipped and counted, control characters and the BOM are not glyphs
+ */
+class CorpusScanner
+{
+public:
+                        CorpusScanner();
+        bool            scanFile(const std::string &file, std::string &error);
+        int             scan(const uint8_t *data, int size, bool last);
+        void            getCodePoints(std::vector<uint32_t> &out);
+        bool            writeFrequencies(const std::string &file);
+        int64_t         total,invalid;
+protected:
+        void            add(uint32_t c);
+        std::vector<uint64_t> counts;               // U+0000..U+FFFF
+        std::map<uint32_t,uint64_t> supplementary; // above
+};
+
+/**
+ * Heatshrink encoder, allocated once and reset for each glyph
+ */
+class HsCompressor
+{
+public:
+                        HsCompressor(int window, int lookahead);
+                        ~HsCompressor();
+        bool            compress(const uint8_t *in, int size, std::vector<uint8_t> &out);
+protected:
+        void            *encoder; // heatshrink_encoder, its header is only included in flatconvert_compression.cpp
+        std::vector<uint8_t> tmp;
+};
+
+/**
+ * One FreeType face per worker thread, loaded once and resized as needed
+ * so that several sizes of the same font do not reparse it
+ */
+class FacePool
+{
+public:
+                        FacePool(const std::string &fontFile, const uint8_t *fontData=NULL, int fontDataSize=0);
+                        ~FacePool();
+        void            reserve(int nb);
+        FT_Face         activate(int worker, int size);
+        int64_t         memoryCost();
+        double          initMs();
+        const std::string &getFontFile() {return fontFile;}
+protected:
+        bool            openFace(int size, FT_Library &library, FT_Face &face, double &initMs);
+        class Slot
+        {
+        public:
+            FT_Library  library;
+            FT_Face     face;
+            std::map<int,FT_Size> sizes; // point size => FT_Size, the first one created with the face
+            double      initMs;    // FT_Init_FreeType
+        };
+        std::string     fontFile;
+        const uint8_t   *fontData;     // FT_New_Memory_Face, not owned
+        int             fontDataSize;
+        std::vector<Slot> slots;
 };
 
 /**
@@ -120,30 +514,234 @@ public:
                         FontConverter(const std::string &fontFile, const std::string &symbolName, const std::string &outputFile);
                         ~FontConverter();
         bool           enableCompression() {compressed=true;return true;}
-        bool           init(int size,int bpp, int first, int last,int *mapp);
+        bool           enableDictionary() {compressed=true;useDictionary=true;return true;}
+        bool           enableAdaptive() {compressed=true;adaptive=true;return true;}
+        void           enableDedup() {dedup=true;}
+        void           enableIncbin(const std::string &bitmapFile) {incbinFile=bitmapFile;}
+        void           enableCache(const std::string &dir) {cacheDir=dir;}
+        void           enableFormat(int tag, uint32_t fg, uint32_t bg) {format=tag;fgColor=fg;bgColor=bg;}
+        int            storedBpp() {return format ? format : bpp;} // what goes in PFXfont::bpp
+        void           enableRotation(int quarterTurns) {rotation=quarterTurns&3;}
+        void           enableTrim(bool rowGaps) {trim=true;trimGaps=rowGaps;}
+        void           enableAtlas(int width, int height, int align) {atlasWidth=width;atlasHeight=height;atlasAlign=align;}
+        void           enableKerning() {kerning=true;}
+        void           enableGlyphStats() {glyphStats=true;}
+        void           enableStreaming() {streaming=true;}
+        void           shareFaces(FacePool *pool) {faces=pool;}
+        void           attachOutput(FILE *f) {output=f;ownOutput=false;}
+        void           shareArray(const char *suffix, const std::string &owner);
+        bool           isShared(const char *suffix);
+        std::string    arrayName(const char *suffix);
+        void           getBitmap(std::vector<uint8_t> &bitmap);
+        int            bitmapSize() {return spool ? spoolSize : bitPusher.offset();}
+        const std::vector<uint8_t> &getDictionary() {return dictionary;}
+        void           setThreads(int nb) {nbThreads=nb<1 ? 1 : nb;}
+        bool           init(int size,int bpp, const std::vector<uint32_t> &codePoints, bool sparse);
         bool           convert();
         void           printHeader();
+        void           printFont(bool withHeader);
+        const ConversionStats &getStats() {return stats;}
         void           printIndex();
+        void           printGlyph(const PFXglyph &glyph, uint32_t code);
+        void           buildGlyphTable(std::vector<PFXglyph> &table);
+        void           buildRanges(std::vector<PFXrange> &ranges);
+        bool           layoutOffsets();
+        void           printOffsetBases();
+        int            glyphIndex(int i) {return sparse ? i : codePoints[i]-first;}
+        int            nbGlyphEntries() {return sparse ? codePoints.size() : last-first+1;}
         void           printFooter();
         void           printBitmap();
-        bool           compressInPlace(uint8_t *in, int &inoutSize);
- static char           printable(int c);
+        void           printByteArray(const char *suffix, const uint8_t *data, int sz, int align=0);
+        void           printIncbin(const char *suffix, const char *file);
+        bool           setHeatshrinkParameters(int window, int lookahead);
+        void           enableParameterSearch(int ramBudget) {hsSearch=true;hsRamBudget=ramBudget;}
+ static bool           compressWithDictionary(const std::vector<uint8_t> &in, const std::vector<uint8_t> &dict,
+                                              int window, int lookahead, std::vector<uint8_t> &out);
+ static void           buildDictionary(const std::vector<EncodedGlyph> &glyphs, int maxSize, std::vector<uint8_t> &dict);
+ static int            dictionarySize(int window);
+ static void           encodeRle(const std::vector<uint8_t> &packed, int width, int height, int bpp, std::vector<uint8_t> &out);
+        bool           encodeAdaptive(EncodedGlyph &e, HsCompressor &compressor);
+        bool           pickAdaptive(const EncodedGlyph &e, HsCompressor &compressor, const std::vector<uint8_t> *dict,
+                                    int window, int lookahead, std::vector<uint8_t> &out, int &encoding);
+ static int            hsDecoderRam(int window);
+        int            shrinkMode();
+        void           describeFont(PFXfont &font);
+        bool           compressGlyphs(std::vector<EncodedGlyph> &glyphs);
+        bool           compressGlyph(EncodedGlyph &e, HsCompressor &compressor);
+        bool           searchParameters(const std::vector<EncodedGlyph> &glyphs);
+        bool           checkCompressed(EncodedGlyph &e);
+        bool           verifyGlyphs(const std::vector<EncodedGlyph> &encoded);
+        bool           verifyGlyph(const PFXfont &font, const PFXglyph *glyph, const EncodedGlyph &e, uint32_t code,
+                                   std::vector<uint8_t> &scratch, std::vector<uint8_t> &pixels);
+        bool           verifyIndex();
+        void           describeIndex(PFXfont &font, std::vector<PFXglyph> &table, std::vector<PFXrange> &ranges);
+        void           toDisplayFormat(EncodedGlyph &e);
+        void           trimGlyph(EncodedGlyph &e);
+        bool           buildAtlas(const std::vector<EncodedGlyph> &encoded);
+        bool           verifyAtlas(const std::vector<EncodedGlyph> &encoded);
+        void           printAtlas();
+        bool           extractKerning();
+        GlyphStats     describeGlyph(uint32_t code, const EncodedGlyph &e, bool cached);
+        void           printKerning();
+ static PFXglyph       storedGlyph(const EncodedGlyph &e);
+ static bool           sparseLayout(const std::vector<uint32_t> &codePoints, bool forced);
+ static int            sparseSaving(const std::vector<uint32_t> &codePoints);
+ static int            formatSourceBpp(int format);
+ static const char    *formatName(int format);
+ static std::string    printable(uint32_t c);
         bool           saveBitmap(const char *bitmap);
+        bool           saveBlob(const char *file);
+        bool           buildBlob(std::vector<uint8_t> &blob, bool withBitmap=true);
         
 protected:
     bool                initFreeType(int size);
-    bool                convert1bit();
-    bool                convertNbit(int n);
-    FT_Library          library;
+    bool                convertGlyph(FT_Face face, int code, BitPusher &pusher, EncodedGlyph &out);
+    bool                convert1bit(FT_Face face, int code, BitPusher &pusher, EncodedGlyph &out);
+    bool                convertNbit(FT_Face face, int code, int n, BitPusher &pusher, EncodedGlyph &out);
+    bool                finishGlyph(BitPusher &pusher, EncodedGlyph &out);
+    bool                convertStreaming();
+    bool                readSpool(const std::function<bool(const uint8_t *,int)> &fn);
+    bool                spoolEquals(uint32_t offset, const std::vector<uint8_t> &bytes, std::vector<uint8_t> &buffer);
+    bool                writeSpooled(const std::string &file, const std::vector<uint8_t> &before, int padding);
+    static bool         metricsFit(int code, int width, int height, int advance, int left, int top);
+    static void         rotateBitmap(const FT_Bitmap &in, int rotation, std::vector<uint8_t> &buffer, FT_Bitmap &out);
+    static void         rotateMetrics(int rotation, int width, int height, int &xOffset, int &yOffset);
+    static bool         runParallel(int nb, int nbThreads, const std::function<bool(int,int)> &fn, int minPerThread=FC_MIN_GLYPHS_PER_THREAD);
+    FacePool            *faces;
+    std::unique_ptr<FacePool> ownFaces; // when not shared
     FT_Face             face;
     std::string         fontFile,symbolName,outputFile;
-    bool                ftInited;
-    int                 first,last, bpp;  
+    std::string         incbinFile; // bitmap pulled by the assembler from that file, empty : C array
+    std::string         cacheDir;   // glyph cache, empty : none
+    uint32_t            first,last;
+    int                 bpp;  
+    int                 format;          // PFX_FORMAT_xxx, 0 : packed grey levels
+    uint32_t            fgColor,bgColor; // 0xRRGGBB, RGB formats
+    int                 rotation;        // PFX_ROTATE_xxx
+    bool                trim;            // crop the blank edges of each glyph
+    bool                trimGaps;        // and leave out the longest run of blank rows
+    int                 atlasWidth;      // atlas pages instead of a bitmap, 0 : none
+    int                 atlasHeight;     // 0 : one page, as high as needed
+    int                 atlasAlign;      // row stride alignment in bytes
+    int                 atlasPageHeight,atlasStride,atlasPages;
+    std::vector<PFXatlasRect> atlasRects; // one per code point
+    std::vector<uint8_t> atlasPixels;
+    bool                kerning;         // extract the pair adjustments
+    bool                glyphStats;      // per glyph entries in stats
+    bool                streaming;       // glyphs written to the spool as they come, see flatconvert_stream.cpp
+    FILE                *spool;          // streamed bitmap, NULL : in bitPusher
+    uint32_t            spoolSize;
+    std::vector<uint32_t> kerningPairs;  // sorted, left glyph index << 16 | right glyph index
+    std::vector<int8_t> kerningValues;   // pixels, one per pair
+    bool                sparse;
+    std::vector<uint32_t> codePoints; // sorted, listOfGlyphs has one entry per code point
     bool                compressed;
+    bool                useDictionary;
+    bool                adaptive;
+    bool                dedup;
+    std::vector<uint8_t> dictionary;
+    int                 hsWindow,hsLookahead;
+    bool                hsSearch;
+    int                 hsRamBudget; // 0 : no limit
     std::vector<PFXglyph > listOfGlyphs;
+    std::vector<uint32_t> bitmapOffsets; // absolute, listOfGlyphs holds them relative to offsetBases
+    std::vector<uint32_t> offsetBases;   // large fonts only
+    int                 offsetBlockShift;
     BitPusher           bitPusher;
     int                 face_height;
     FILE                *output;
+    bool                ownOutput;
+    std::map<std::string,std::string> sharedArrays; // suffix => symbol of the font holding it
     int                 _totalUncompressedSize;
-    const int           *_mapp; 
+    int64_t             _totalDecodeCycles,_totalDrawCycles;
+    int                 _maxDecodeCycles,_maxDrawCycles;
+    PFXdecodeStats      _drawStats; // summed over all the glyphs drawn by verifyGlyphs
+    int                 _dedupGlyphs,_dedupBytes;
+    std::atomic<int>    _trimGlyphs,_trimBytes,_gapGlyphs,_gapBytes; // streaming workers trim concurrently
+    int                 nbThreads;
+    int                 fontSize;
+    ConversionStats     stats;
 };
+
+/**
+ * Why a job failed, see libflatconvert.h
+ */
+enum FcStatus
+{
+    FC_OK=0,
+    FC_ERROR_PARAMETERS,  // the job does not make sense
+    FC_ERROR_FONT,        // FreeType cannot load the font
+    FC_ERROR_CONVERSION,  // rendering, compression or the check of the output failed
+    FC_ERROR_OUTPUT,      // a file cannot be written
+};
+
+class EmittedFont;
+class FcFont;
+/**
+ * One conversion job : what is given on the command line, or by one line
+ * of a batch manifest
+ */
+class FontJob
+{
+public:
+                        FontJob();
+        bool            prepare(std::string &error);
+        bool            run(std::string &error);
+        bool            convert(FILE *output, std::vector<FcFont> *fonts, std::string &error);
+        std::string     statsJson();
+        std::string     variantSymbol(int size, int bpp);
+
+        std::string     fontFile,outputFile,bitmapFile,blobFile,pick;
+        const uint8_t   *fontData;    // font already in memory, fontFile only names the symbols then
+        int             fontDataSize;
+        FcStatus        status;       // set when prepare/run fail
+        FacePool        *faces;       // warm faces from the server, NULL : loaded for the job
+        bool            sideFiles;    // write bitmap_file & blob_file, the server leaves them to its client
+        std::vector<std::string> corpusFiles; // code points used there are picked too
+        std::string     frequencyFile;        // code point counts of the corpus, empty : none
+        std::string     statsFile;            // timings & per glyph stats as JSON, empty : none
+        std::string     symbolName;   // of the first size/bpp
+        std::string     symbolPrefix;
+        int             symbolBits;
+        int             size,bpp,first,last;
+        std::vector<int> sizes,bpps;  // all in the same file, default : size & bpp
+        int             threads;
+        bool            compression;
+        bool            dictionary;
+        bool            adaptive;
+        bool            dedup;
+        bool            incbin;
+        std::string     cacheDir;
+        int             format;          // PFX_FORMAT_xxx, 0 : grey levels at bpp
+        uint32_t        fgColor,bgColor;
+        int             rotation;        // degrees clockwise, 0/90/180/270
+        bool            trim,trimGaps;
+        int             atlasWidth,atlasHeight,atlasAlign;
+        bool            kerning;
+        bool            stream;          // bounded memory, see FontConverter::convertStreaming
+        int             hsWindow,hsLookahead;
+        bool            hsSearch;
+        int             hsRamBudget;
+        bool            sparse;
+        std::vector<uint32_t> codePoints;
+        std::vector<ConversionStats> stats; // one per size/bpp, filled by run()
+protected:
+        bool            runVariant(FacePool &faces, FILE *output, int size, int bpp,
+                                   std::vector<EmittedFont> &emitted, FcFont *font, std::string &error);
+};
+
+bool        writeIfChanged(const std::string &file, const uint8_t *data, int size);
+int64_t     fcPeakMemoryKb();
+bool        replaceIfChanged(const std::string &tmp, const std::string &file);
+std::string tmpFileName(const std::string &file, const void *owner);
+bool        utf8Decode(const std::string &in, std::vector<uint32_t> &out, std::string &error);
+std::string utf8Encode(uint32_t code);
+bool parseIntList(const std::string &value, std::vector<int> &out);
+bool parseFileList(const std::string &value, std::vector<std::string> &out);
+bool parseFormat(const std::string &name, int &format);
+bool parseColor(const std::string &value, uint32_t &color);
+bool loadManifest(const std::string &manifest, std::vector<FontJob> &jobs);
+typedef std::function<bool(const std::vector<std::string> &args, FontJob &job, std::string &error)> JobParser;
+int  runServer(const std::string &socketPath, int cacheMb, const JobParser &parser);
+bool runClient(const std::string &socketPath, const std::vector<std::string> &args, int &status);
+int  runBatch(std::vector<FontJob> &jobs, int nbThreads);
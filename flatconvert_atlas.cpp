@@ -0,0 +1,200 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "flatconvert.h"
+#include "algorithm"
+
+/**
+ * Shelf packing : glyphs sorted by height, laid left to right, a new shelf
+ * below when the page width is reached, a new page when its height is.
+ * Pages are atlasWidth pixels wide, rows are padded to atlasAlign bytes.
+ * @param encoded
+ * @return false if a glyph does not fit in a page
+ */
+bool FontConverter::buildAtlas(const std::vector<EncodedGlyph> &encoded)
+{
+    int nb=encoded.size();
+    std::vector<int> order;
+    for(int i=0;i<nb;i++)
+        if(encoded[i].rendered && encoded[i].glyph.width && encoded[i].glyph.height)
+            order.push_back(i);
+    std::stable_sort(order.begin(),order.end(),[&](int a, int b)
+    {
+        const PFXglyph &ga=encoded[a].glyph,&gb=encoded[b].glyph;
+        if(ga.height!=gb.height) return ga.height>gb.height;
+        return ga.width>gb.width;
+    });
+
+    PFXatlasRect zero={0,0,0,0,0};
+    atlasRects.assign(nb,zero);
+    int xAlign= bpp==4 ? 2 : 1; // 4 bpp glyphs start on a byte
+    int page=0,x=0,y=0,shelf=0,used=0;
+    for(int k=0;k<(int)order.size();k++)
+    {
+        const PFXglyph &g=encoded[order[k]].glyph;
+        if(g.width>atlasWidth || (atlasHeight && g.height>atlasHeight))
+        {
+            printf("Glyph '%s' (%dx%d) does not fit in a %dx%d atlas page\n",printable(codePoints[order[k]]).c_str(),
+                   g.width,g.height,atlasWidth,atlasHeight);
+            return false;
+        }
+        if(x+g.width>atlasWidth)
+        {
+            x=0;
+            y+=shelf+FC_ATLAS_PADDING;
+            shelf=0;
+        }
+        if(atlasHeight && y+g.height>atlasHeight)
+        {
+            page++;
+            x=y=0;
+            shelf=0; // the old shelf height would push the next row of the new page down
+        }
+        PFXatlasRect &r=atlasRects[order[k]];
+        r.x=x;
+        r.y=y;
+        r.width=g.width;
+        r.height=g.height;
+        r.page=page;
+        if(g.height>shelf) shelf=g.height;
+        if(y+shelf>used) used=y+shelf;
+        x+=g.width+FC_ATLAS_PADDING;
+        x=(x+xAlign-1)/xAlign*xAlign;
+    }
+    atlasPages=page+1;
+    if(atlasPages>255)
+    {
+        printf("Atlas needs %d pages, 255 max, use bigger pages\n",atlasPages);
+        return false;
+    }
+    atlasPageHeight=atlasHeight ? atlasHeight : (used ? used : 1);
+    atlasStride=(atlasWidth*bpp+7)/8;
+    atlasStride=(atlasStride+atlasAlign-1)/atlasAlign*atlasAlign;
+
+    atlasPixels.assign((size_t)atlasPages*atlasPageHeight*atlasStride,0);
+    for(int k=0;k<(int)order.size();k++)
+    {
+        const EncodedGlyph &e=encoded[order[k]];
+        const PFXatlasRect &r=atlasRects[order[k]];
+        for(int row=0;row<r.height;row++)
+        {
+            uint8_t *line=atlasPixels.data()+((size_t)r.page*atlasPageHeight+r.y+row)*atlasStride;
+            for(int col=0;col<r.width;col++)
+            {
+                int v=pfxPackedPixel(e.raw.data(),row*r.width+col,bpp);
+                int px=r.x+col;
+                if(bpp==8)
+                    line[px]=v;
+                else
+                    line[px>>1]|=(px&1) ? v : v<<4;
+            }
+        }
+    }
+    return true;
+}
+/**
+ * Read every glyph back from the atlas
+ * @param encoded
+ * @return
+ */
+bool FontConverter::verifyAtlas(const std::vector<EncodedGlyph> &encoded)
+{
+    std::vector<PFXglyph> table;
+    std::vector<PFXrange> ranges;
+    std::vector<PFXatlasRect> rects(atlasRects);
+    buildGlyphTable(table);
+    if(sparse)
+        buildRanges(ranges);
+    else
+    {
+        PFXatlasRect zero={0,0,0,0,0};
+        rects.assign(last-first+1,zero);
+        for(int i=0;i<(int)codePoints.size();i++)
+            rects[codePoints[i]-first]=atlasRects[i];
+    }
+    PFXfont font;
+    describeFont(font);
+    font.glyph=table.data();
+    font.first=first>0xFFFF ? 0xFFFF : first;
+    font.last=last>0xFFFF ? 0xFFFF : last;
+    font.ranges=ranges.size() ? ranges.data() : NULL;
+    font.nbRanges=ranges.size();
+    PFXatlas atlas={atlasPixels.data(),rects.data(),&font,(uint16_t)atlasWidth,(uint16_t)atlasPageHeight,
+                    (uint16_t)atlasStride,(uint8_t)bpp,(uint8_t)atlasPages};
+    for(int i=0;i<(int)codePoints.size();i++)
+    {
+        const EncodedGlyph &e=encoded[i];
+        if(!e.rendered || !e.glyph.width || !e.glyph.height) continue;
+        const PFXatlasRect *r=pfxAtlasRect(&atlas,codePoints[i]);
+        if(!r || r->width!=e.glyph.width || r->height!=e.glyph.height)
+        {
+            printf("Glyph 0x%x missing from the atlas\n",codePoints[i]);
+            return false;
+        }
+        for(int row=0;row<r->height;row++)
+        {
+            const uint8_t *line=pfxAtlasRow(&atlas,r,row);
+            for(int col=0;col<r->width;col++)
+            {
+                int v= bpp==8 ? line[col] : (line[col>>1]>>((col&1) ? 0 : 4))&0xF;
+                if(v!=pfxPackedPixel(e.raw.data(),row*r->width+col,bpp))
+                {
+                    printf("Glyph 0x%x is not in the atlas as rendered\n",codePoints[i]);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+/**
+ * Rectangles, in glyph table order, and the PFXatlas pointing to the pages
+ */
+void FontConverter::printAtlas()
+{
+    std::vector<PFXatlasRect> rects(atlasRects);
+    if(!sparse)
+    {
+        PFXatlasRect zero={0,0,0,0,0};
+        rects.assign(last-first+1,zero);
+        for(int i=0;i<(int)codePoints.size();i++)
+            rects[codePoints[i]-first]=atlasRects[i];
+    }
+    fprintf(output,"const PFXatlasRect %sAtlasRects[] PROGMEM = {\n", symbolName.c_str());
+    for(int i=0;i<(int)rects.size();i++)
+    {
+        const PFXatlasRect &r=rects[i];
+        uint32_t code=sparse ? codePoints[i] : first+i;
+        fprintf(output,"  { %4d, %4d, %3d, %3d, %3d},   // 0x%02X '%s'\n",r.x,r.y,r.width,r.height,r.page,code,printable(code).c_str());
+    }
+    fprintf(output,"};\n\n");
+    fprintf(output,"const PFXatlas %sAtlas PROGMEM = {\n", symbolName.c_str());
+    fprintf(output,"  %sAtlasPixels,\n", symbolName.c_str());
+    fprintf(output,"  %sAtlasRects,\n", symbolName.c_str());
+    fprintf(output,"  &%s,\n", symbolName.c_str());
+    fprintf(output,"  %d, %d, %d, // page width, height, stride \n",atlasWidth,atlasPageHeight,atlasStride);
+    fprintf(output,"  %d, %d}; // bit per pixel, pages \n\n",bpp,atlasPages);
+
+    int inked=0;
+    for(int i=0;i<(int)atlasRects.size();i++)
+        inked+=atlasRects[i].width*atlasRects[i].height;
+    int sz=atlasPixels.size();
+    int area=atlasPages*atlasPageHeight*atlasWidth;
+    fprintf(output,"// Atlas : %d page(s) of %dx%d, stride %d, %d bytes (%d kBytes), %d %% filled\n",
+            atlasPages,atlasWidth,atlasPageHeight,atlasStride,sz,(sz+1023)/1024,area ? (100*inked)/area : 0);
+}
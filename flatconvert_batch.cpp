@@ -0,0 +1,792 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "libflatconvert.h"
+#include "thread"
+#include "atomic"
+#include "mutex"
+#include "chrono"
+#include "memory"
+#include "algorithm"
+#include "unistd.h"
+
+/**
+ * 
+ */
+FontJob::FontJob()
+{
+    fontData=NULL;
+    fontDataSize=0;
+    status=FC_OK;
+    faces=NULL;
+    sideFiles=true;
+    size=0;
+    bpp=1;
+    first=32;
+    last=127;
+    threads=1;
+    compression=false;
+    dictionary=false;
+    adaptive=false;
+    dedup=false;
+    incbin=false;
+    format=0;
+    fgColor=0xFFFFFF;
+    bgColor=0;
+    rotation=0;
+    trim=false;
+    trimGaps=false;
+    atlasWidth=atlasHeight=0;
+    atlasAlign=FC_ATLAS_ALIGN;
+    kerning=false;
+    stream=false;
+    hsWindow=FC_HS_WINDOW;
+    hsLookahead=FC_HS_LOOKAHEAD;
+    hsSearch=false;
+    hsRamBudget=0;
+    sparse=false;
+    symbolBits=7;
+}
+/**
+ * Keep the first occurrence of each value, in order
+ * @param list
+ */
+static void removeDuplicates(std::vector<int> &list)
+{
+  std::vector<int> out;
+  for(int i=0;i<(int)list.size();i++)
+    if(std::find(out.begin(),out.end(),list[i])==out.end())
+      out.push_back(list[i]);
+  list=out;
+}
+/**
+ * Derive the symbol name, the default output file and the glyph map
+ * @param error
+ * @return 
+ */
+bool FontJob::prepare(std::string &error)
+{
+  status=FC_ERROR_PARAMETERS; // until everything checked out
+  if(!fontFile.size())
+  {
+      error="no font file";
+      return false;
+  }
+  if(fontData && cacheDir.size())
+  {
+      error="the glyph cache needs a font file";
+      return false;
+  }
+  if(format)
+  {
+      // display formats come with their own depth
+      if(bpps.size()>1)
+      {
+          error="display formats need a single bpp";
+          return false;
+      }
+      bpps.assign(1,FontConverter::formatSourceBpp(format));
+  }
+  if(!sizes.size()) sizes.push_back(size);
+  if(!bpps.size()) bpps.push_back(bpp);
+  removeDuplicates(sizes);
+  removeDuplicates(bpps);
+  for(int i=0;i<(int)sizes.size();i++)
+  {
+    if(sizes[i]<=0)
+    {
+        error="invalid font size";
+        return false;
+    }
+  }
+  size=sizes[0];
+  bpp=bpps[0];
+  int nbVariants=sizes.size()*bpps.size();
+  if(nbVariants>1 && (bitmapFile.size() || blobFile.size() || incbin))
+  {
+      error="bitmap, blob and incbin files need a single size and bpp";
+      return false;
+  }
+  if(atlasWidth)
+  {
+      for(int i=0;i<(int)bpps.size();i++)
+        if(bpps[i]!=4 && bpps[i]!=8)
+        {
+            error="atlas pages are 4 or 8 bpp";
+            return false;
+        }
+      if(atlasWidth<0 || atlasWidth>0xFFFF || atlasHeight<0 || atlasHeight>0xFFFF || atlasAlign<=0 || (atlasAlign&(atlasAlign-1)))
+      {
+          error="invalid atlas size or alignment";
+          return false;
+      }
+      if(compression || dictionary || adaptive || format || incbin || bitmapFile.size() || blobFile.size())
+      {
+          error="atlas output is not compressed and has no bitmap, blob or display format";
+          return false;
+      }
+  }
+  if(stream && (dictionary || hsSearch || atlasWidth || cacheDir.size()))
+  {
+      error="streaming compresses each glyph on its own : no dictionary, parameter search, atlas or glyph cache";
+      return false;
+  }
+  if(hsRamBudget<0 || (hsRamBudget && !compression && !dictionary && !adaptive))
+  {
+      error="hs_ram needs heatshrink compression";
+      return false;
+  }
+  // without a search, the window given (or the default one) must fit too
+  if(hsRamBudget && !hsSearch && !dictionary && FontConverter::hsDecoderRam(hsWindow)>hsRamBudget)
+  {
+      error="heatshrink window "+std::to_string(hsWindow)+" needs "+std::to_string(FontConverter::hsDecoderRam(hsWindow))
+            +" bytes of decoder RAM, more than hs_ram";
+      return false;
+  }
+  if(rotation<0 || rotation>270 || rotation%90)
+  {
+      error="rotation must be 0, 90, 180 or 270";
+      return false;
+  }
+  if(first<0 || first>FC_MAX_CODEPOINT || last<0 || last>FC_MAX_CODEPOINT)
+  {
+      error="glyph range must be within 0..0x10FFFF";
+      return false;
+  }
+  if(first>last) std::swap(first,last);
+  std::string fileName = fontFile.substr(fontFile.find_last_of("/\\") + 1);
+  fileName= std::regex_replace(fileName, std::regex(" "), "_");  
+  fileName= std::regex_replace(fileName, std::regex("-"), "_");  
+  std::string::size_type const p(fileName.find_last_of('.'));
+  fileName = fileName.substr(0, p);
+  
+  
+  symbolPrefix=fileName;
+  symbolBits=(last > 127) ? 8 : 7;
+  
+  // full var name
+  symbolName=variantSymbol(size,bpp);
+
+  if(!outputFile.size())
+  {
+      outputFile=(nbVariants>1 ? symbolPrefix : symbolName)+std::string(".h");
+  }
+  if(incbin && !bitmapFile.size())
+  {
+      // foo.h => foo.bin
+      std::string::size_type const dot(outputFile.find_last_of('.'));
+      std::string::size_type const slash(outputFile.find_last_of("/\\"));
+      if(dot!=std::string::npos && (slash==std::string::npos || dot>slash))
+          bitmapFile=outputFile.substr(0,dot);
+      else
+          bitmapFile=outputFile;
+      bitmapFile+=".bin";
+  }
+ 
+  codePoints.clear();
+  if(corpusFiles.size())
+  {
+        CorpusScanner corpus;
+        for(int i=0;i<(int)corpusFiles.size();i++)
+            if(!corpus.scanFile(corpusFiles[i],error))
+                return false;
+        if(frequencyFile.size() && !corpus.writeFrequencies(frequencyFile))
+        {
+            error="cannot write "+frequencyFile;
+            return false;
+        }
+        corpus.getCodePoints(codePoints);
+  }else if(frequencyFile.size())
+  {
+        error="corpus_freq needs a corpus";
+        return false;
+  }
+  if(pick.size() || corpusFiles.size())
+  {
+        // -k is UTF-8, added to what the corpus uses
+        if(!utf8Decode(pick,codePoints,error))
+            return false;
+        if(!codePoints.size())
+        {
+            error="no glyph picked";
+            return false;
+        }
+        std::sort(codePoints.begin(),codePoints.end());
+        codePoints.erase(std::unique(codePoints.begin(),codePoints.end()),codePoints.end());
+        first=codePoints.front();
+        last=codePoints.back();
+  }else
+  {
+        for(int i=first;i<=last;i++) codePoints.push_back(i);
+  }
+  if(FontConverter::sparseLayout(codePoints,sparse) && codePoints.size()>FC_MAX_SPARSE_GLYPHS)
+  {
+      error="too many glyphs for a sparse font, at most 65535";
+      return false;
+  }
+  status=FC_OK;
+  return true;
+}
+/**
+ * Symbol of one size/bpp, the bpp only appears when several are generated
+ * @param size
+ * @param bpp
+ * @return 
+ */
+std::string FontJob::variantSymbol(int size, int bpp)
+{
+  char ext[32];
+  sprintf(ext, "%dpt%db", size, symbolBits);
+  std::string symbol=symbolPrefix+std::string(ext);
+  if(bpps.size()>1)
+  {
+      sprintf(ext, "_%dbpp", bpp);
+      symbol+=ext;
+  }
+  return symbol;
+}
+/**
+ * Comma separated list of integers, "12,16,20"
+ * @param value
+ * @param out
+ * @return false if empty or not a number
+ */
+bool parseIntList(const std::string &value, std::vector<int> &out)
+{
+  out.clear();
+  const char *p=value.c_str();
+  while(*p)
+  {
+      char *end;
+      long v=strtol(p,&end,0);
+      if(end==p) return false;
+      out.push_back((int)v);
+      p=end;
+      while(*p==' ') p++;
+      if(*p==',') p++;
+      else if(*p) return false;
+  }
+  return out.size()>0;
+}
+/**
+ * What an earlier font of the same file emitted, to spot identical arrays
+ */
+class EmittedFont
+{
+public:
+        std::string             symbol;
+        std::vector<uint8_t>    bitmap;
+        std::vector<PFXglyph>   glyphs;
+        std::vector<uint8_t>    dictionary;
+};
+
+/**
+ * Do the actual conversion, nothing is shared with other jobs, so several
+ * jobs can run at the same time on different threads
+ * All the size/bpp variants go to the same file and share the FreeType faces
+ * @param error
+ * @return 
+ */
+bool FontJob::run(std::string &error)
+{
+  // written aside, the output is only replaced (and its date changed) if its content changed
+  std::string tmp=tmpFileName(outputFile,this);
+  FILE *output=fopen(tmp.c_str(),"wb");
+  if(!output)
+  {
+      status=FC_ERROR_OUTPUT;
+      error="cannot open output file";
+      return false;
+  }
+  bool ok=convert(output,NULL,error);
+  if(fclose(output) && ok)
+  {
+      status=FC_ERROR_OUTPUT;
+      ok=false;
+  }
+  if(!ok)
+  {
+      unlink(tmp.c_str());
+      if(!error.size()) error="cannot write output file";
+      return false;
+  }
+  if(!replaceIfChanged(tmp,outputFile))
+  {
+      status=FC_ERROR_OUTPUT;
+      error="cannot write output file";
+      return false;
+  }
+  return true;
+}
+/**
+ * All the size/bpp variants, the header going to output, which the caller closes
+ * @param output
+ * @param fonts if not NULL, gets each variant as a blob, see libflatconvert.h
+ * @param error
+ * @return false with status & error set
+ */
+bool FontJob::convert(FILE *output, std::vector<FcFont> *fonts, std::string &error)
+{
+  std::unique_ptr<FacePool> own;
+  FacePool *pool=faces;
+  if(!pool)
+  {
+      own.reset(new FacePool(fontFile,fontData,fontDataSize));
+      pool=own.get();
+  }
+  std::vector<EmittedFont> emitted;
+  stats.clear();
+  if(fonts) fonts->clear();
+  status=FC_OK;
+  bool ok=true;
+  for(int s=0;s<(int)sizes.size() && ok;s++)
+    for(int b=0;b<(int)bpps.size() && ok;b++)
+    {
+      FcFont *font=NULL;
+      if(fonts)
+      {
+        fonts->push_back(FcFont());
+        font=&fonts->back();
+      }
+      ok=runVariant(*pool,output,sizes[s],bpps[b],emitted,font,error);
+    }
+  if(ok && ferror(output))
+  {
+      status=FC_ERROR_OUTPUT;
+      error="cannot write output";
+      ok=false;
+  }
+  if(ok && sideFiles && statsFile.size())
+  {
+      std::string json=statsJson();
+      if(!writeIfChanged(statsFile,(const uint8_t *)json.data(),json.size()))
+      {
+          status=FC_ERROR_OUTPUT;
+          error="cannot write "+statsFile;
+          ok=false;
+      }
+  }
+  return ok;
+}
+/**
+ * One size & bpp, appended to output
+ * @param faces
+ * @param output
+ * @param size
+ * @param bpp
+ * @param emitted fonts already in the file
+ * @param font NULL, or filled with the blob & stats of the variant
+ * @param error
+ * @return 
+ */
+bool FontJob::runVariant(FacePool &faces, FILE *output, int size, int bpp, std::vector<EmittedFont> &emitted, FcFont *font, std::string &error)
+{
+  std::string symbol=variantSymbol(size,bpp);
+  // heap allocated : the bitmap buffer is too big for a worker stack
+  std::unique_ptr<FontConverter> holder(new FontConverter(fontFile,symbol,outputFile));
+  FontConverter &converter=*holder;
+  converter.shareFaces(&faces);
+  converter.attachOutput(output);
+  
+  if(!converter.init(size,bpp,codePoints,sparse))
+  {
+      // prepare() made sure there are glyphs, FreeType is what failed
+      status=FC_ERROR_FONT;
+      error="cannot load font "+fontFile;
+      return false;
+  }
+  if(compression)
+  {
+      converter.enableCompression();
+  }
+  if(dictionary)
+  {
+      converter.enableDictionary();
+  }
+  if(adaptive)
+  {
+      converter.enableAdaptive();
+  }
+  if(dedup)
+  {
+      converter.enableDedup();
+  }
+  if(incbin)
+  {
+      converter.enableIncbin(bitmapFile);
+  }
+  if(cacheDir.size())
+  {
+      converter.enableCache(cacheDir);
+  }
+  if(format)
+  {
+      converter.enableFormat(format,fgColor,bgColor);
+  }
+  if(rotation)
+  {
+      converter.enableRotation(rotation/90);
+  }
+  if(trim || trimGaps)
+  {
+      converter.enableTrim(trimGaps);
+  }
+  if(atlasWidth)
+  {
+      converter.enableAtlas(atlasWidth,atlasHeight,atlasAlign);
+  }
+  if(kerning)
+  {
+      converter.enableKerning();
+  }
+  if(statsFile.size())
+  {
+      converter.enableGlyphStats();
+  }
+  if(stream)
+  {
+      converter.enableStreaming();
+  }
+  if(!converter.setHeatshrinkParameters(hsWindow,hsLookahead))
+  {
+      status=FC_ERROR_PARAMETERS;
+      error="invalid heatshrink parameters";
+      return false;
+  }
+  if(hsSearch)
+  {
+      converter.enableParameterSearch(hsRamBudget);
+  }
+  converter.setThreads(threads);
+  
+  if(!converter.convert())
+  {
+      status=FC_ERROR_CONVERSION;
+      error="failed to convert";
+      return false;
+  } 
+
+  // sizes landing on the same bitmap strike give the very same arrays
+  // streamed bitmaps stay in their spool, they are not compared
+  EmittedFont mine;
+  mine.symbol=symbol;
+  if(!stream)
+      converter.getBitmap(mine.bitmap);
+  converter.buildGlyphTable(mine.glyphs);
+  mine.dictionary=converter.getDictionary();
+  for(int i=0;i<(int)emitted.size();i++)
+  {
+      const EmittedFont &e=emitted[i];
+      if(!stream && !converter.isShared("Bitmaps") && e.bitmap==mine.bitmap)
+          converter.shareArray("Bitmaps",e.symbol);
+      if(!converter.isShared("Glyphs") && e.glyphs.size()==mine.glyphs.size() &&
+         !memcmp(e.glyphs.data(),mine.glyphs.data(),mine.glyphs.size()*sizeof(PFXglyph)))
+          converter.shareArray("Glyphs",e.symbol);
+      if(!converter.isShared("Dictionary") && mine.dictionary.size() && e.dictionary==mine.dictionary)
+          converter.shareArray("Dictionary",e.symbol);
+  }
+
+  converter.printFont(!emitted.size());
+  stats.push_back(converter.getStats());
+  emitted.push_back(mine);
+  if(sideFiles && bitmapFile.size())
+  {
+      if(!converter.saveBitmap(bitmapFile.c_str()))
+      {
+          status=FC_ERROR_OUTPUT;
+          error="cannot write bitmap file";
+          return false;
+      }
+  }  
+  if(sideFiles && blobFile.size())
+  {
+      if(!converter.saveBlob(blobFile.c_str()))
+      {
+          status=FC_ERROR_OUTPUT;
+          error="cannot write blob file";
+          return false;
+      }
+  }
+  if(font)
+  {
+      font->symbol=symbol;
+      font->size=size;
+      font->bpp=bpp;
+      font->stats=stats.back();
+      // atlas fonts have no blob, their pixels only are in the header
+      if(!atlasWidth && !converter.buildBlob(font->blob))
+      {
+          status=FC_ERROR_CONVERSION;
+          error="cannot build blob";
+          return false;
+      }
+  }
+  return true;
+}
+
+/**
+ * Split a manifest line into key=value pairs, values can be double quoted
+ * @param line
+ * @param job
+ * @param error
+ * @return 
+ */
+static bool parseManifestLine(const std::string &line, FontJob &job, std::string &error)
+{
+    int l=line.size();
+    int i=0;
+    while(1)
+    {
+        while(i<l && isspace((unsigned char)line[i])) i++;
+        if(i>=l || line[i]=='#') break;
+        int start=i;
+        while(i<l && line[i]!='=' && !isspace((unsigned char)line[i])) i++;
+        if(i>=l || line[i]!='=')
+        {
+            error="expected key=value";
+            return false;
+        }
+        std::string key=line.substr(start,i-start);
+        std::string value;
+        i++;
+        if(i<l && line[i]=='"')
+        {
+            i++;
+            while(i<l && line[i]!='"')
+            {
+                if(line[i]=='\\' && i+1<l) i++;
+                value+=line[i++];
+            }
+            if(i>=l)
+            {
+                error="unterminated string";
+                return false;
+            }
+            i++;
+        }else
+        {
+            while(i<l && !isspace((unsigned char)line[i])) value+=line[i++];
+        }
+        if(key=="font")             job.fontFile=value;
+        else if(key=="size")        job.size=atoi(value.c_str());
+        else if(key=="bpp")         job.bpp=atoi(value.c_str());
+        else if(key=="sizes" || key=="bpps")
+        {
+            if(!parseIntList(value,key=="sizes" ? job.sizes : job.bpps))
+            {
+                error="invalid list for "+key;
+                return false;
+            }
+        }
+        else if(key=="pick")        job.pick=value;
+        else if(key=="corpus")
+        {
+            if(!parseFileList(value,job.corpusFiles))
+            {
+                error="invalid corpus "+value;
+                return false;
+            }
+        }
+        else if(key=="corpus_freq") job.frequencyFile=value;
+        else if(key=="stats")       job.statsFile=value;
+        else if(key=="begin_char")  job.first=strtol(value.c_str(),NULL,0);
+        else if(key=="end_char")    job.last=strtol(value.c_str(),NULL,0);
+        else if(key=="output_file") job.outputFile=value;
+        else if(key=="bitmap_file") job.bitmapFile=value;
+        else if(key=="blob_file")   job.blobFile=value;
+        else if(key=="compression") job.compression=(value=="1" || value=="true" || value=="yes");
+        else if(key=="dictionary")  job.dictionary=(value=="1" || value=="true" || value=="yes");
+        else if(key=="adaptive")    job.adaptive=(value=="1" || value=="true" || value=="yes");
+        else if(key=="dedup")       job.dedup=(value=="1" || value=="true" || value=="yes");
+        else if(key=="incbin")      job.incbin=(value=="1" || value=="true" || value=="yes");
+        else if(key=="cache")       job.cacheDir=value;
+        else if(key=="format" || key=="fg" || key=="bg")
+        {
+            bool ok= key=="format" ? parseFormat(value,job.format)
+                                   : parseColor(value,key=="fg" ? job.fgColor : job.bgColor);
+            if(!ok)
+            {
+                error="invalid "+key+" "+value;
+                return false;
+            }
+        }
+        else if(key=="trim")        job.trim=(value=="1" || value=="true" || value=="yes");
+        else if(key=="trim_rows")   job.trimGaps=(value=="1" || value=="true" || value=="yes");
+        else if(key=="atlas")       job.atlasWidth=atoi(value.c_str());
+        else if(key=="atlas_height") job.atlasHeight=atoi(value.c_str());
+        else if(key=="atlas_align") job.atlasAlign=atoi(value.c_str());
+        else if(key=="kerning")     job.kerning=(value=="1" || value=="true" || value=="yes");
+        else if(key=="stream")      job.stream=(value=="1" || value=="true" || value=="yes");
+        else if(key=="rotate")      job.rotation=atoi(value.c_str());
+        else if(key=="hs_window")   job.hsWindow=atoi(value.c_str());
+        else if(key=="hs_lookahead") job.hsLookahead=atoi(value.c_str());
+        else if(key=="hs_search")   job.hsSearch=(value=="1" || value=="true" || value=="yes");
+        else if(key=="hs_ram")      job.hsRamBudget=atoi(value.c_str());
+        else if(key=="threads")     job.threads=atoi(value.c_str());
+        else if(key=="sparse")      job.sparse=(value=="1" || value=="true" || value=="yes");
+        else
+        {
+            error="unknown key "+key;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Load a batch manifest, one job per line, same keys as the long command line options
+ *   font=Foo.ttf size=12 bpp=4 compression=1 pick="0123456789" output_file=foo12.h
+ * Empty lines and lines starting with # are ignored
+ * @param manifest
+ * @param jobs
+ * @return 
+ */
+bool loadManifest(const std::string &manifest, std::vector<FontJob> &jobs)
+{
+    FILE *f=fopen(manifest.c_str(),"rt");
+    if(!f)
+    {
+        fprintf(stderr,"Cannot open manifest %s\n",manifest.c_str());
+        return false;
+    }
+    char buffer[4096];
+    int lineNo=0;
+    bool ok=true;
+    while(fgets(buffer,sizeof(buffer),f))
+    {
+        lineNo++;
+        std::string line(buffer);
+        while(line.size() && (line.back()=='\n' || line.back()=='\r')) line.pop_back();
+        FontJob job;
+        std::string error;
+        if(!parseManifestLine(line,job,error))
+        {
+            fprintf(stderr,"%s:%d : %s\n",manifest.c_str(),lineNo,error.c_str());
+            ok=false;
+            continue;
+        }
+        if(!job.fontFile.size() && !job.size) continue; // empty / comment
+        jobs.push_back(job);
+    }
+    fclose(f);
+    return ok;
+}
+
+/**
+ * Jobs writing the same file would clobber each other : all of them fail
+ * @param jobs prepared
+ * @param ok false for the jobs that failed already, the others are set here
+ * @param errors
+ */
+static void rejectSharedFiles(std::vector<FontJob> &jobs, std::vector<char> &ok, std::vector<std::string> &errors)
+{
+    std::map<std::string,int> owner; // file => first job writing it
+    for(int i=0;i<(int)jobs.size();i++)
+    {
+        if(!ok[i]) continue;
+        FontJob &job=jobs[i];
+        const std::string *files[]={&job.outputFile,&job.bitmapFile,&job.blobFile,&job.statsFile};
+        for(int f=0;f<4;f++)
+        {
+            if(!files[f]->size()) continue;
+            auto it=owner.find(*files[f]);
+            if(it==owner.end())
+            {
+                owner[*files[f]]=i;
+                continue;
+            }
+            int other=it->second;
+            for(int j : {i,other})
+            {
+                if(!ok[j]) continue;
+                ok[j]=false;
+                jobs[j].status=FC_ERROR_PARAMETERS;
+                errors[j]=*files[f]+" is written by several manifest entries";
+            }
+        }
+    }
+}
+
+/**
+ * Run all the jobs on a pool of nbThreads workers
+ * Each job owns its FreeType library & face, so nothing FreeType related is shared
+ * All the jobs are prepared first, so that two of them writing the same file
+ * are rejected before any of them runs
+ * @param jobs
+ * @param nbThreads
+ * @return number of failed jobs
+ */
+int runBatch(std::vector<FontJob> &jobs, int nbThreads)
+{
+    int nbJobs=jobs.size();
+    if(nbThreads<1) nbThreads=1;
+    if(nbThreads>nbJobs) nbThreads=nbJobs;
+    std::vector<char> ok(nbJobs,0);
+    std::vector<std::string> errors(nbJobs);
+    std::vector<int> ms(nbJobs,0);
+    std::atomic<int> failed(0);
+    std::mutex       logMutex;
+
+    auto forEachJob=[&](const std::function<void(int)> &fn)
+    {
+        std::atomic<int> next(0);
+        auto worker=[&]()
+        {
+            while(1)
+            {
+                int i=next++;
+                if(i>=nbJobs) return;
+                fn(i);
+            }
+        };
+        std::vector<std::thread> pool;
+        for(int i=0;i<nbThreads;i++)
+            pool.push_back(std::thread(worker));
+        for(int i=0;i<nbThreads;i++)
+            pool[i].join();
+    };
+    forEachJob([&](int i)
+    {
+        auto start=std::chrono::steady_clock::now();
+        ok[i]=jobs[i].prepare(errors[i]);
+        ms[i]=(int)fcElapsedMs(start);
+    });
+    rejectSharedFiles(jobs,ok,errors);
+    forEachJob([&](int i)
+    {
+        FontJob &job=jobs[i];
+        if(ok[i])
+        {
+            auto start=std::chrono::steady_clock::now();
+            ok[i]=job.run(errors[i]);
+            ms[i]+=(int)fcElapsedMs(start);
+        }
+        std::lock_guard<std::mutex> lock(logMutex);
+        if(ok[i])
+        {
+            printf("[ok]     %s (%d ms)\n",job.outputFile.c_str(),ms[i]);
+        }else
+        {
+            failed++;
+            printf("[FAILED] %s %dpt %dbpp : %s\n",job.fontFile.c_str(),job.size,job.bpp,errors[i].c_str());
+        }
+    });
+    printf("%d jobs, %d failed\n",nbJobs,(int)failed);
+    return failed;
+}
+// EOF
@@ -0,0 +1,398 @@
+/*
+Conversion speed & output size regression harness.
+
+Converts the fonts of a corpus (a --batch manifest), records the time and
+the bytes of each phase, writes them as JSON and compares them with a
+stored baseline. It also checks the BitPusher row packing against golden
+digests.
+
+  flatconvert_bench [--corpus bench/corpus.txt] [--fonts bench/fonts]
+                    [--baseline bench/baseline.json] [--update]
+
+Exit code is non zero on a regression, a missing corpus font, a case
+missing from the baseline or no baseline at all (unless --update).
+*/
+#include "flatconvert.h"
+#include "cxxopts.hpp"
+#include "unistd.h"
+
+#define BENCH_GOLDEN_ROWS  4096
+#define BENCH_NOISE_MS     5.0  // time differences below that are never regressions
+
+/**
+ * FNV-1a, the digest of outputs in the baseline & golden files
+ */
+static uint64_t fnv(const uint8_t *data, int size, uint64_t hash=0xcbf29ce484222325ULL)
+{
+    for(int i=0;i<size;i++)
+    {
+        hash^=data[i];
+        hash*=0x100000001b3ULL;
+    }
+    return hash;
+}
+static std::string hex64(uint64_t v)
+{
+    char s[32];
+    sprintf(s,"%016llx",(unsigned long long)v);
+    return std::string(s);
+}
+static bool fileDigest(const std::string &file, uint64_t &hash)
+{
+    FILE *f=fopen(file.c_str(),"rb");
+    if(!f) return false;
+    hash=0xcbf29ce484222325ULL;
+    uint8_t chunk[4096];
+    size_t nb;
+    while((nb=fread(chunk,1,sizeof(chunk),f))>0)
+        hash=fnv(chunk,nb,hash);
+    fclose(f);
+    return true;
+}
+
+//-- BitPusher golden digests
+
+/**
+ * Same rows on every platform : own generator, not rand()
+ * Mostly black & white with some edges, widths 1..96, 1 bpp rows packed
+ */
+static uint64_t packDigest(int bpp, const PackKernels *kernels)
+{
+    uint32_t seed=12345;
+    auto next=[&seed]() { seed=seed*1103515245+12345; return (seed>>16)&0x7FFF; };
+    BitPusher pusher;
+    uint8_t line[96];
+    for(int i=0;i<BENCH_GOLDEN_ROWS;i++)
+    {
+        int w=1+next()%96;
+        for(int x=0;x<w;x++)
+        {
+            int r=next()%8;
+            line[x]= r<3 ? 0 : r<6 ? 255 : next()&0xFF;
+        }
+        if(bpp==1)
+        {
+            uint8_t packed[12]={0};
+            for(int x=0;x<w;x++)
+                if(line[x]&0x80) packed[x>>3]|=0x80>>(x&7);
+            memcpy(line,packed,sizeof(packed));
+        }
+        if(kernels)
+        {
+            pusher.addRow(line,w,bpp,*kernels);
+            continue;
+        }
+        for(int x=0;x<w;x++) // the reference, one pixel at a time
+        {
+            switch(bpp)
+            {
+                case 1: pusher.addBit(line[x>>3]&(0x80>>(x&7)));break;
+                case 2: {int pix=(line[x]+31)>>6; pusher.add2Bits(pix>3 ? 3 : pix);} break;
+                case 4: pusher.add4Bits(line[x]>>4);break;
+                case 8: pusher.add8Bits(line[x]);break;
+            }
+        }
+    }
+    pusher.align();
+    return fnv(pusher.data(),pusher.offset());
+}
+
+/**
+ * Every kernel and the per pixel path must give the golden digest
+ * @param golden file, one "bpp digest" per line
+ * @param update rewrite it instead
+ * @return true if all match
+ */
+static bool checkGolden(const std::string &golden, bool update)
+{
+    const int bpps[]={1,2,4,8};
+    int nbKernels;
+    const PackKernels *kernels=allPackKernels(nbKernels);
+    std::map<int,std::string> expected;
+    FILE *f=fopen(golden.c_str(),"rt");
+    if(f)
+    {
+        int bpp;
+        char digest[64];
+        while(fscanf(f,"%d %63s",&bpp,digest)==2)
+            expected[bpp]=digest;
+        fclose(f);
+    }
+    bool ok=true;
+    std::string out;
+    for(int b=0;b<4;b++)
+    {
+        int bpp=bpps[b];
+        std::string reference=hex64(packDigest(bpp,NULL));
+        out+=std::to_string(bpp)+" "+reference+"\n";
+        if(!update)
+        {
+            if(!expected.count(bpp))
+            {
+                printf("golden  %d bpp : no golden digest\n",bpp);
+                ok=false;
+            }else if(expected[bpp]!=reference)
+            {
+                printf("golden  %d bpp : per pixel path DIFFERENT\n",bpp);
+                ok=false;
+            }
+        }
+        for(int k=0;k<nbKernels;k++)
+        {
+            bool same=hex64(packDigest(bpp,kernels+k))==reference;
+            printf("golden  %d bpp %-8s : %s\n",bpp,kernels[k].name,same ? "bit exact" : "DIFFERENT");
+            if(!same) ok=false;
+        }
+    }
+    if(update)
+    {
+        f=fopen(golden.c_str(),"wt");
+        if(!f)
+        {
+            printf("Cannot write %s\n",golden.c_str());
+            return false;
+        }
+        fputs(out.c_str(),f);
+        fclose(f);
+    }
+    return ok;
+}
+
+//-- Corpus
+
+/**
+ * One conversion of the corpus, all its sizes/bpp summed
+ */
+class BenchCase
+{
+public:
+    std::string     name;
+    double          totalMs;
+    ConversionStats sum;
+    std::string     digest;
+};
+
+static std::string caseName(const FontJob &job)
+{
+    std::string font=job.fontFile.substr(job.fontFile.find_last_of("/\\")+1);
+    char s[128];
+    sprintf(s,"%s %dpt %dbpp 0x%X-0x%X%s%s%s",font.c_str(),job.size,job.bpp,job.first,job.last,
+            job.pick.size() ? " pick" : "",job.compression ? " hs" : "",job.dictionary ? " dict" : "");
+    return std::string(s);
+}
+
+/**
+ * Best of repeat runs
+ * @return false if the conversion failed
+ */
+static bool runCase(FontJob job, const std::string &output, int repeat, BenchCase &c, std::string &error)
+{
+    job.outputFile=output;
+    if(!job.prepare(error)) return false;
+    c.name=caseName(job);
+    c.totalMs=1e30;
+    for(int r=0;r<repeat;r++)
+    {
+        unlink(output.c_str());
+        auto start=std::chrono::steady_clock::now();
+        if(!job.run(error)) return false;
+        double ms=fcElapsedMs(start);
+        if(ms>=c.totalMs) continue;
+        c.totalMs=ms;
+        c.sum=ConversionStats();
+        for(int i=0;i<(int)job.stats.size();i++)
+        {
+            const ConversionStats &s=job.stats[i];
+            c.sum.nbGlyphs+=s.nbGlyphs;
+            c.sum.loadMs+=s.loadMs;
+            c.sum.renderMs+=s.glyphLoadMs+s.renderMs; // FT_Load_Char included, as in the baseline
+            c.sum.packMs+=s.packMs;
+            c.sum.compressMs+=s.compressMs;
+            c.sum.emitMs+=s.emitMs;
+            c.sum.renderBytes+=s.renderBytes;
+            c.sum.packBytes+=s.packBytes;
+            c.sum.compressBytes+=s.compressBytes;
+            c.sum.emitBytes+=s.emitBytes;
+        }
+    }
+    uint64_t hash;
+    if(!fileDigest(output,hash))
+    {
+        error="no output";
+        return false;
+    }
+    c.digest=hex64(hash);
+    unlink(output.c_str());
+    return true;
+}
+
+/**
+ * One case per line, so that the baseline can be read back line by line
+ */
+static bool writeJson(const std::string &file, const std::vector<BenchCase> &cases, bool goldenOk)
+{
+    FILE *f=fopen(file.c_str(),"wt");
+    if(!f) return false;
+    fprintf(f,"{\n  \"kernel\": \"%s\",\n  \"golden\": \"%s\",\n  \"cases\": [\n",packKernels().name,goldenOk ? "ok" : "failed");
+    for(int i=0;i<(int)cases.size();i++)
+    {
+        const BenchCase &c=cases[i];
+        const ConversionStats &s=c.sum;
+        fprintf(f,"    {\"name\": \"%s\", \"glyphs\": %d, \"total_ms\": %.3f, "
+                  "\"load_ms\": %.3f, \"render_ms\": %.3f, \"pack_ms\": %.3f, \"compress_ms\": %.3f, \"emit_ms\": %.3f, "
+                  "\"render_bytes\": %lld, \"pack_bytes\": %lld, \"compress_bytes\": %lld, \"emit_bytes\": %lld, "
+                  "\"digest\": \"%s\"}%s\n",
+                  c.name.c_str(),s.nbGlyphs,c.totalMs,
+                  s.loadMs,s.renderMs,s.packMs,s.compressMs,s.emitMs,
+                  (long long)s.renderBytes,(long long)s.packBytes,(long long)s.compressBytes,(long long)s.emitBytes,
+                  c.digest.c_str(),i+1<(int)cases.size() ? "," : "");
+    }
+    fprintf(f,"  ]\n}\n");
+    return !fclose(f);
+}
+/**
+ * Value of "key": in a line written by writeJson, quotes removed
+ */
+static std::string jsonField(const std::string &line, const std::string &key)
+{
+    std::string k="\""+key+"\": ";
+    std::string::size_type p=line.find(k);
+    if(p==std::string::npos) return std::string();
+    p+=k.size();
+    if(line[p]=='"')
+        return line.substr(p+1,line.find('"',p+1)-p-1);
+    return line.substr(p,line.find_first_of(",}",p)-p);
+}
+/**
+ * @return false if there is no baseline to compare with
+ */
+static bool readBaseline(const std::string &file, std::map<std::string,BenchCase> &baseline)
+{
+    FILE *f=fopen(file.c_str(),"rt");
+    if(!f) return false;
+    char buffer[4096];
+    while(fgets(buffer,sizeof(buffer),f))
+    {
+        std::string line(buffer);
+        std::string name=jsonField(line,"name");
+        if(!name.size()) continue;
+        BenchCase c;
+        c.name=name;
+        c.totalMs=atof(jsonField(line,"total_ms").c_str());
+        c.sum.compressBytes=atoll(jsonField(line,"compress_bytes").c_str());
+        c.digest=jsonField(line,"digest");
+        baseline[name]=c;
+    }
+    fclose(f);
+    return baseline.size()>0;
+}
+
+int main(int argc, char *argv[])
+{
+    cxxopts::Options options("flatconvert_bench", "flatconvert speed & size regression harness");
+    options.add_options()
+      ("corpus",          "fonts to convert, --batch manifest syntax",  cxxopts::value<std::string>()->default_value("bench/corpus.txt"))
+      ("fonts",           "directory of the corpus fonts",  cxxopts::value<std::string>()->default_value("bench/fonts"))
+      ("json",            "results",  cxxopts::value<std::string>()->default_value("flatconvert_bench.json"))
+      ("baseline",        "results to compare with",  cxxopts::value<std::string>()->default_value("bench/baseline.json"))
+      ("golden",          "BitPusher golden digests",  cxxopts::value<std::string>()->default_value("bench/golden.txt"))
+      ("time_tolerance",  "allowed slowdown in %",  cxxopts::value<int>()->default_value("25"))
+      ("size_tolerance",  "allowed bitmap growth in %",  cxxopts::value<int>()->default_value("0"))
+      ("repeat",          "runs per case, the fastest is kept",  cxxopts::value<int>()->default_value("3"))
+      ("update",          "write the results as the new baseline & golden digests",  cxxopts::value<bool>()->default_value("false"))
+    ;
+    cxxopts::ParseResult result=options.parse(argc, argv);
+    std::string fontsDir=result["fonts"].as<std::string>();
+    std::string baselineFile=result["baseline"].as<std::string>();
+    bool update=result["update"].as<bool>();
+    int timeTolerance=result["time_tolerance"].as<int>();
+    int sizeTolerance=result["size_tolerance"].as<int>();
+    int repeat=result["repeat"].as<int>();
+    if(repeat<1) repeat=1;
+
+    printf("Row packing kernel : %s\n",packKernels().name);
+    bool goldenOk=checkGolden(result["golden"].as<std::string>(),update);
+
+    std::vector<FontJob> jobs;
+    if(!loadManifest(result["corpus"].as<std::string>(),jobs))
+        return 1;
+    std::map<std::string,BenchCase> baseline;
+    if(!update && !readBaseline(baselineFile,baseline))
+    {
+        printf("No baseline in %s, run once with --update to create it\n",baselineFile.c_str());
+        return 1;
+    }
+
+    std::vector<BenchCase> cases;
+    int regressions=0;
+    std::string output="flatconvert_bench.tmp.h";
+    printf("\n%-50s %9s %9s %9s %9s %9s %9s %10s  %s\n","case","total ms","load","render","pack","compress","emit","bitmap","");
+    for(int i=0;i<(int)jobs.size();i++)
+    {
+        FontJob job=jobs[i];
+        if(job.fontFile.size() && job.fontFile[0]!='/')
+            job.fontFile=fontsDir+"/"+job.fontFile;
+        if(access(job.fontFile.c_str(),R_OK))
+        {
+            printf("%-50s FAILED : missing font\n",job.fontFile.c_str());
+            regressions++;
+            continue;
+        }
+        BenchCase c;
+        std::string error;
+        if(!runCase(job,output,repeat,c,error))
+        {
+            printf("%-50s FAILED : %s\n",job.fontFile.c_str(),error.c_str());
+            regressions++;
+            continue;
+        }
+        const ConversionStats &s=c.sum;
+        std::string verdict;
+        auto it=baseline.find(c.name);
+        if(it==baseline.end())
+        {
+            if(!update)
+            {
+                verdict=" NOT IN BASELINE";
+                regressions++;
+            }
+        }else
+        {
+            const BenchCase &b=it->second;
+            if(c.totalMs>b.totalMs*(100+timeTolerance)/100 && c.totalMs-b.totalMs>BENCH_NOISE_MS)
+                verdict+=" SLOWER("+std::to_string((int)b.totalMs)+"ms)";
+            if(s.compressBytes*100>b.sum.compressBytes*(100+sizeTolerance))
+                verdict+=" BIGGER("+std::to_string((long long)b.sum.compressBytes)+")";
+            if(c.digest!=b.digest)
+                verdict+=" CHANGED";
+            if(verdict.size()) regressions++;
+            else verdict="ok";
+        }
+        printf("%-50s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %10lld %s\n",c.name.c_str(),c.totalMs,
+               s.loadMs,s.renderMs,s.packMs,s.compressMs,s.emitMs,(long long)s.compressBytes,verdict.c_str());
+        cases.push_back(c);
+        if(it!=baseline.end())
+            baseline.erase(it);
+    }
+    // a case that vanished from the corpus or failed is not compared, report it
+    for(auto it=baseline.begin();it!=baseline.end();it++)
+    {
+        printf("%-50s MISSING, in the baseline only\n",it->first.c_str());
+        regressions++;
+    }
+
+    std::string json=result["json"].as<std::string>();
+    if(update && regressions)
+    {
+        printf("\n%d cases failed, baseline %s NOT updated\n",regressions,baselineFile.c_str());
+        update=false;
+    }
+    if(!writeJson(json,cases,goldenOk) || (update && !writeJson(baselineFile,cases,goldenOk)))
+    {
+        printf("Cannot write results\n");
+        return 1;
+    }
+    printf("\n%d cases, %d regressions, golden %s, results in %s\n",(int)cases.size(),regressions,goldenOk ? "ok" : "FAILED",json.c_str());
+    if(update) printf("Baseline %s updated\n",baselineFile.c_str());
+    return (regressions || !goldenOk) ? 1 : 0;
+}
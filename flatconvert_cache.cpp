@@ -0,0 +1,311 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "flatconvert.h"
+#include "unistd.h"
+
+#define FC_CACHE_MAGIC   0x43474346 // "FCGC"
+#define FC_CACHE_VERSION 1
+
+/**
+ * FNV-1a of the font file, the cache follows the font content, not its name or date
+ * @param fontFile
+ * @param hash
+ * @return 
+ */
+static bool hashFile(const std::string &fontFile, uint64_t &hash)
+{
+    FILE *f=fopen(fontFile.c_str(),"rb");
+    if(!f) return false;
+    hash=0xcbf29ce484222325ULL;
+    std::vector<uint8_t> chunk(FC_BUFFER_SIZE);
+    size_t nb;
+    while((nb=fread(chunk.data(),1,chunk.size(),f))>0)
+    {
+        for(size_t i=0;i<nb;i++)
+        {
+            hash^=chunk[i];
+            hash*=0x100000001b3ULL;
+        }
+    }
+    fclose(f);
+    return true;
+}
+/**
+ * Whole file in memory, false if it does not exist
+ * @param file
+ * @param data
+ * @return 
+ */
+static bool readFile(const std::string &file, std::vector<uint8_t> &data)
+{
+    FILE *f=fopen(file.c_str(),"rb");
+    if(!f) return false;
+    data.clear();
+    std::vector<uint8_t> chunk(FC_BUFFER_SIZE);
+    size_t nb;
+    while((nb=fread(chunk.data(),1,chunk.size(),f))>0)
+        data.insert(data.end(),chunk.begin(),chunk.begin()+nb);
+    fclose(f);
+    return true;
+}
+/**
+ * Write file only if its content changes, so that its date only moves when
+ * it has to and what depends on it is not rebuilt for nothing
+ * @param file
+ * @param data
+ * @param size
+ * @return false on write error
+ */
+bool writeIfChanged(const std::string &file, const uint8_t *data, int size)
+{
+    std::vector<uint8_t> old;
+    if(readFile(file,old) && (int)old.size()==size && (!size || !memcmp(old.data(),data,size)))
+    {
+        printf("%s unchanged\n",file.c_str());
+        return true;
+    }
+    FILE *f=fopen(file.c_str(),"wb");
+    if(!f) return false;
+    bool ok=!size || fwrite(data,size,1,f)==1;
+    if(fclose(f)) ok=false;
+    return ok;
+}
+/**
+ * Compare two files chunk by chunk, big outputs are never loaded whole
+ * @param a
+ * @param b
+ * @return false if they differ or one cannot be read
+ */
+static bool sameFiles(const std::string &a, const std::string &b)
+{
+    FILE *fa=fopen(a.c_str(),"rb");
+    if(!fa) return false;
+    FILE *fb=fopen(b.c_str(),"rb");
+    if(!fb)
+    {
+        fclose(fa);
+        return false;
+    }
+    std::vector<uint8_t> ca(FC_BUFFER_SIZE),cb(FC_BUFFER_SIZE);
+    bool same=true;
+    while(same)
+    {
+        size_t na=fread(ca.data(),1,ca.size(),fa);
+        size_t nb=fread(cb.data(),1,cb.size(),fb);
+        same=(na==nb) && !memcmp(ca.data(),cb.data(),na);
+        if(!na) break;
+    }
+    fclose(fa);
+    fclose(fb);
+    return same;
+}
+/**
+ * Temporary name to write file under before replaceIfChanged or rename,
+ * unique per process and per owner so that parallel jobs never share it
+ * @param file
+ * @param owner the object writing it
+ * @return
+ */
+std::string tmpFileName(const std::string &file, const void *owner)
+{
+    char suffix[64];
+    sprintf(suffix,".%d.%p.tmp",(int)getpid(),owner);
+    return file+suffix;
+}
+/**
+ * Same thing for a file already written under a temporary name
+ * @param tmp
+ * @param file
+ * @return 
+ */
+bool replaceIfChanged(const std::string &tmp, const std::string &file)
+{
+    if(sameFiles(tmp,file))
+    {
+        printf("%s unchanged\n",file.c_str());
+        unlink(tmp.c_str());
+        return true;
+    }
+    if(rename(tmp.c_str(),file.c_str()))
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * 
+ */
+GlyphCache::GlyphCache()
+{
+    hits=0;
+    misses=0;
+    fontHash=0;
+    dirty=false;
+}
+/**
+ * Find the cache file matching the font & rendering parameters and load it
+ * @param dir
+ * @param fontFile
+ * @param library the glyphs are rendered with, its TrueType interpreter is part of the key
+ * @param size
+ * @param bpp
+ * @param loadTarget FT_LOAD_TARGET_xxx the glyphs are loaded with
+ * @param rotation PFX_ROTATE_xxx, glyphs are cached rotated
+ * @return false if the font cannot be read
+ */
+bool GlyphCache::open(const std::string &dir, const std::string &fontFile, FT_Library library, int size, int bpp, int loadTarget, int rotation)
+{
+    if(!hashFile(fontFile,fontHash))
+    {
+        printf("Cache : cannot read %s\n",fontFile.c_str());
+        return false;
+    }
+    // FreeType version, hinting engine and load target change the rendering too
+    // the interpreter is the one in use : setting v35 fails if FreeType was built without it
+    FT_UInt interpreter=0;
+    if(FT_Property_Get(library,"truetype","interpreter-version",&interpreter))
+        interpreter=0;
+    char name[160];
+    char rotated[8]="";
+    if(rotation)
+        sprintf(rotated,"_r%d",rotation);
+    sprintf(name,"%016llx_%d_%d_%d%s_tt%u_lt%d_ft%d.%d.%d.glyphs",(unsigned long long)fontHash,size,DPI,bpp,rotated,
+            interpreter,(int)FT_LOAD_TARGET_MODE(loadTarget),FREETYPE_MAJOR,FREETYPE_MINOR,FREETYPE_PATCH);
+    file=dir;
+    if(file.size() && file.back()!='/') file+="/";
+    file+=name;
+    if(!load())
+    {
+        printf("Cache : ignoring invalid %s\n",file.c_str());
+        entries.clear();
+    }
+    return true;
+}
+/**
+ * 
+ * @return false if the file exists but is not valid
+ */
+bool GlyphCache::load()
+{
+    std::vector<uint8_t> data;
+    if(!readFile(file,data)) return true; // not there yet
+    BlobReader r(data);
+    if(r.u32()!=FC_CACHE_MAGIC || r.u32()!=FC_CACHE_VERSION) return false;
+    uint32_t hashLow=r.u32();
+    uint32_t hashHigh=r.u32();
+    if(hashLow!=(uint32_t)fontHash || hashHigh!=(uint32_t)(fontHash>>32)) return false;
+    int nb=r.u32();
+    for(int i=0;i<nb && !r.failed;i++)
+    {
+        uint32_t code=r.u32();
+        EncodedGlyph e;
+        e.rendered=r.u8()!=0;
+        e.glyph.width=r.u8();
+        e.glyph.height=r.u8();
+        e.glyph.xAdvance=r.u8();
+        e.glyph.xOffset=(int8_t)r.u8();
+        e.glyph.yOffset=(int8_t)r.u8();
+        int sz=r.u32();
+        const uint8_t *raw=r.bytes(sz);
+        if(!raw) return false;
+        e.rawSize=sz;
+        e.raw.assign(raw,raw+sz);
+        entries[code]=e;
+    }
+    return !r.failed;
+}
+/**
+ * 
+ * @param code
+ * @param out
+ * @return true if found
+ */
+bool GlyphCache::lookup(uint32_t code, EncodedGlyph &out)
+{
+    auto it=entries.find(code);
+    if(it==entries.end())
+    {
+        misses++;
+        return false;
+    }
+    hits++;
+    out=it->second;
+    out.data=out.raw; // replaced when compressing
+    return true;
+}
+/**
+ * 
+ * @param code
+ * @param e
+ */
+void GlyphCache::store(uint32_t code, const EncodedGlyph &e)
+{
+    EncodedGlyph &c=entries[code];
+    c.rendered=e.rendered;
+    c.glyph=e.glyph;
+    c.rawSize=e.rawSize;
+    c.raw=e.raw;
+    dirty=true;
+}
+/**
+ * Written under a temporary name first, jobs sharing a font can run at the same time
+ * @return 
+ */
+bool GlyphCache::save()
+{
+    if(!dirty) return true;
+    BlobWriter w;
+    w.u32(FC_CACHE_MAGIC);
+    w.u32(FC_CACHE_VERSION);
+    w.u32((uint32_t)fontHash);
+    w.u32((uint32_t)(fontHash>>32));
+    w.u32(entries.size());
+    for(auto it=entries.begin();it!=entries.end();it++)
+    {
+        const EncodedGlyph &e=it->second;
+        w.u32(it->first);
+        w.u8(e.rendered);
+        w.u8(e.glyph.width);
+        w.u8(e.glyph.height);
+        w.u8(e.glyph.xAdvance);
+        w.u8(e.glyph.xOffset);
+        w.u8(e.glyph.yOffset);
+        w.u32(e.raw.size());
+        w.bytes(e.raw.data(),e.raw.size());
+    }
+    std::string tmp=tmpFileName(file,this);
+    FILE *f=fopen(tmp.c_str(),"wb");
+    if(!f)
+    {
+        printf("Cache : cannot write %s\n",tmp.c_str());
+        return false;
+    }
+    bool ok=fwrite(w.data.data(),w.data.size(),1,f)==1;
+    if(fclose(f)) ok=false;
+    if(!ok || rename(tmp.c_str(),file.c_str()))
+    {
+        unlink(tmp.c_str());
+        printf("Cache : cannot write %s\n",file.c_str());
+        return false;
+    }
+    dirty=false;
+    return true;
+}
@@ -17,39 +17,57 @@ Keep 7-bit fonts around as an option in that case, more compact.
 See notes at end for glyph nomenclature & other tidbits.
 */
 #include "flatconvert.h"
+#include "unordered_map"
+#include "algorithm"
+#include "memory"
 extern "C"
 {
 #include "heatshrink_encoder.h"
 }
+/**
+ * 
+ * @param window
+ * @param lookahead
+ */
+HsCompressor::HsCompressor(int window, int lookahead)
+{
+    encoder=heatshrink_encoder_alloc(window, lookahead);
+}
+/**
+ * 
+ */
+HsCompressor::~HsCompressor()
+{
+    if(encoder)
+        heatshrink_encoder_free((heatshrink_encoder *)encoder);
+    encoder=NULL;
+}
 /**
  *
  * @return
  */
- bool FontConverter::compressInPlace(uint8_t *in, int &inoutSize)
+ bool HsCompressor::compress(const uint8_t *src, int size, std::vector<uint8_t> &out)
  {
-     uint8_t tmp[FC_BUFFER_SIZE];
-     //printf("Compressing...\n");
-     bitPusher.align();
-     const uint8_t *src=in;
-     int     size=inoutSize;
-
-     heatshrink_encoder *hse = heatshrink_encoder_alloc(8, 4); // 8 4
+     heatshrink_encoder *hse = (heatshrink_encoder *)encoder;
      if(!hse)
      {
          printf("Cannot initialize heatshrink\n");
-         exit(-1);
+         return false;
      }
+    heatshrink_encoder_reset(hse);
+    // worst case is 9 bits per byte
+    size_t comp_sz=size+(size+7)/8+16;
+    if(tmp.size()<comp_sz) tmp.resize(comp_sz);
     size_t sunk = 0;
     size_t count=0;
     size_t polled = 0;
-    size_t comp_sz=FC_BUFFER_SIZE;
     while (sunk < size)
     {
         HSE_sink_res esres = heatshrink_encoder_sink(hse, (uint8_t *)(src+sunk), size - sunk, &count);
         if(esres <0)
         {
             printf("sink fail\n");
-            exit(-1);
+            return false;
         }
         sunk += count;
 
@@ -58,7 +76,7 @@ extern "C"
             if(HSER_FINISH_MORE!= heatshrink_encoder_finish(hse))
             {
                 printf("Finish fail\n");
-                exit(-1);
+                return false;
             }
         }
 
@@ -67,16 +85,16 @@ extern "C"
         {
             pres = heatshrink_encoder_poll(hse, &tmp[polled], comp_sz - polled, &count);
             polled += count;
-        } while (pres == HSER_POLL_MORE);
+        } while (pres == HSER_POLL_MORE && polled < comp_sz);
         if(HSER_POLL_EMPTY!= pres)
         {
             printf("Poll fail\n");
-            exit(-1);
+            return false;
         }
         if (polled >= comp_sz)
         {
             printf("compression overflow\n");
-            exit(-1);
+            return false;
         }
 
         if (sunk == size)
@@ -84,16 +102,695 @@ extern "C"
             if(HSER_FINISH_DONE!= heatshrink_encoder_finish(hse))
              {
                 printf("done state failed\n");
-                exit(-1);
+                return false;
             }
         }
     }
-    //printf("Input size =%d, output size=%d\n",(int)size,(int)polled);
-    //printf("Shrinked to %d %%\n",(int)((polled*100)/size));    
-    // copy tmp to bitPusher
-    heatshrink_encoder_free(hse);
-    hse=NULL;
-    memcpy(in,tmp,polled);
-    inoutSize=polled;
+    out.assign(tmp.begin(),tmp.begin()+polled);
     return true;
  }
+
+/**
+ * Window & lookahead bits, same limits as heatshrink
+ * @param window
+ * @param lookahead
+ * @return 
+ */
+bool FontConverter::setHeatshrinkParameters(int window, int lookahead)
+{
+    if(window<4 || window>15 || lookahead<3 || lookahead>=window)
+    {
+        printf("Invalid heatshrink parameters, window must be 4..15 and lookahead 3..window-1\n");
+        return false;
+    }
+    hsWindow=window;
+    hsLookahead=lookahead;
+    return true;
+}
+
+/**
+ * Compress all the rendered glyphs, one encoder per thread
+ * @param glyphs
+ * @return 
+ */
+bool FontConverter::compressGlyphs(std::vector<EncodedGlyph> &glyphs)
+{
+    if(useDictionary)
+        buildDictionary(glyphs,dictionarySize(hsWindow),dictionary);
+    std::vector<std::unique_ptr<HsCompressor> > compressors(nbThreads);
+    return runParallel(glyphs.size(),nbThreads,[&](int worker, int i)
+    {
+        EncodedGlyph &e=glyphs[i];
+        if(!e.rendered) return true;
+        if(!compressors[worker])
+            compressors[worker].reset(new HsCompressor(hsWindow,hsLookahead));
+        return compressGlyph(e,*compressors[worker]);
+    });
+}
+/**
+ * One glyph, checked by decoding it back
+ * @param e
+ * @param compressor
+ * @return 
+ */
+bool FontConverter::compressGlyph(EncodedGlyph &e, HsCompressor &compressor)
+{
+    bool ok;
+    if(adaptive)
+        ok=encodeAdaptive(e,compressor);
+    else if(useDictionary)
+        ok=compressWithDictionary(e.raw,dictionary,hsWindow,hsLookahead,e.data);
+    else
+        ok=compressor.compress(e.raw.data(),e.raw.size(),e.data);
+    return ok && checkCompressed(e);
+}
+
+/**
+ * Keep the smallest of raw, RLE, heatshrink and dictionary (when enabled)
+ * On a tie, the one cheapest to decode wins. The choice is on size only : the
+ * kept encoding is then decoded back by checkCompressed, a failure there is an
+ * error, never a reason to fall back to RLE or raw
+ * @param e
+ * @param compressor
+ * @return 
+ */
+bool FontConverter::encodeAdaptive(EncodedGlyph &e, HsCompressor &compressor)
+{
+    int encoding;
+    if(!pickAdaptive(e,compressor,useDictionary ? &dictionary : NULL,hsWindow,hsLookahead,e.data,encoding))
+        return false;
+    e.glyph.flags=(e.glyph.flags&~PFX_GLYPH_ENCODING_MASK)|encoding;
+    return true;
+}
+/**
+ * The choice of encodeAdaptive for the given heatshrink parameters, also
+ * used to score the parameter search trials
+ * @param e
+ * @param compressor set to window/lookahead
+ * @param dict NULL when there is no dictionary
+ * @param window
+ * @param lookahead
+ * @param out the smallest encoding
+ * @param encoding PFX_GLYPH_xxx of out
+ * @return
+ */
+bool FontConverter::pickAdaptive(const EncodedGlyph &e, HsCompressor &compressor, const std::vector<uint8_t> *dict,
+                                 int window, int lookahead, std::vector<uint8_t> &out, int &encoding)
+{
+    std::vector<uint8_t> candidate;
+    out=e.raw;
+    encoding=PFX_GLYPH_RAW;
+
+    if(!format) // runs are grey levels only
+    {
+        encodeRle(e.raw,e.glyph.width,e.glyph.height-e.gapLength,bpp,candidate);
+        if(candidate.size()<out.size())
+        {
+            out.swap(candidate);
+            encoding=PFX_GLYPH_RLE;
+        }
+    }
+    if(!compressor.compress(e.raw.data(),e.raw.size(),candidate))
+        return false;
+    if(candidate.size()<out.size())
+    {
+        out.swap(candidate);
+        encoding=PFX_GLYPH_HEATSHRINK;
+    }
+    if(dict)
+    {
+        if(!compressWithDictionary(e.raw,*dict,window,lookahead,candidate))
+            return false;
+        if(candidate.size()<out.size())
+        {
+            out.swap(candidate);
+            encoding=PFX_GLYPH_DICTIONARY;
+        }
+    }
+    return true;
+}
+
+/**
+ * Row run lengths, see pfxDecodeRle
+ * @param packed
+ * @param width
+ * @param height
+ * @param bpp
+ * @param out
+ */
+void FontConverter::encodeRle(const std::vector<uint8_t> &packed, int width, int height, int bpp, std::vector<uint8_t> &out)
+{
+    int maxRun= bpp==8 ? 256 : 1<<(8-bpp);
+    out.clear();
+    for(int y=0;y<height;y++)
+    {
+        int x=0;
+        while(x<width)
+        {
+            int value=pfxPackedPixel(packed.data(),y*width+x,bpp);
+            int run=1;
+            while(x+run<width && run<maxRun && pfxPackedPixel(packed.data(),y*width+x+run,bpp)==value)
+                run++;
+            if(bpp==8)
+            {
+                out.push_back(value);
+                out.push_back(run-1);
+            }else
+            {
+                out.push_back((value<<(8-bpp))|(run-1));
+            }
+            x+=run;
+        }
+    }
+}
+
+/**
+ * Heatshrink decoder RAM for that many window bits, see --hs_ram
+ * @param window
+ * @return
+ */
+int FontConverter::hsDecoderRam(int window)
+{
+    return (1<<window)+FC_HS_INPUT_BUFFER;
+}
+/**
+ * Try all the window/lookahead combinations, one trial per thread, and keep
+ * the smallest output (bitmap + dictionary) that fits in the decoder RAM budget
+ * Each trial reuses a single encoder for all the glyphs. In adaptive mode each
+ * glyph counts for the encoding encodeAdaptive would keep with these parameters
+ * @param glyphs
+ * @return 
+ */
+bool FontConverter::searchParameters(const std::vector<EncodedGlyph> &glyphs)
+{
+    struct Trial
+    {
+        int window,lookahead;
+        int64_t total;
+    };
+    std::vector<Trial> trials;
+    for(int w=FC_HS_SEARCH_MIN_WINDOW;w<=FC_HS_SEARCH_MAX_WINDOW;w++)
+    {
+        // the dictionary decoder has no window in RAM
+        if(hsRamBudget && !useDictionary && hsDecoderRam(w)>hsRamBudget)
+            continue;
+        for(int l=3;l<w && l<=FC_HS_SEARCH_MAX_LOOKAHEAD;l++)
+        {
+            Trial t={w,l,0};
+            trials.push_back(t);
+        }
+    }
+    if(!trials.size())
+    {
+        printf("No heatshrink window fits in %d bytes of RAM\n",hsRamBudget);
+        return false;
+    }
+    bool ok=runParallel(trials.size(),nbThreads,[&](int, int i)
+    {
+        Trial &t=trials[i];
+        std::vector<uint8_t> out;
+        std::vector<uint8_t> dict;
+        t.total=0;
+        if(useDictionary)
+        {
+            buildDictionary(glyphs,dictionarySize(t.window),dict);
+            t.total=dict.size();
+        }
+        HsCompressor compressor(t.window,t.lookahead);
+        for(int g=0;g<(int)glyphs.size();g++)
+        {
+            const EncodedGlyph &e=glyphs[g];
+            if(!e.rendered) continue;
+            int encoding;
+            bool ok;
+            if(adaptive)
+                ok=pickAdaptive(e,compressor,useDictionary ? &dict : NULL,t.window,t.lookahead,out,encoding);
+            else if(useDictionary)
+                ok=compressWithDictionary(e.raw,dict,t.window,t.lookahead,out);
+            else
+                ok=compressor.compress(e.raw.data(),e.raw.size(),out);
+            if(!ok)
+                return false;
+            t.total+=out.size();
+        }
+        return true;
+    },1);
+    if(!ok)
+        return false;
+    int best=0;
+    for(int i=1;i<(int)trials.size();i++)
+        if(trials[i].total<trials[best].total)
+            best=i;
+    printf("Heatshrink parameters : window %d, lookahead %d (%d bytes)\n",trials[best].window,trials[best].lookahead,(int)trials[best].total);
+    return setHeatshrinkParameters(trials[best].window,trials[best].lookahead);
+}
+
+/**
+ * MSB first bit writer, same bit order as heatshrink
+ */
+class BitWriter
+{
+public:
+    BitWriter(std::vector<uint8_t> &o) : out(o)
+    {
+        acc=0;
+        nbBits=0;
+    }
+    void put(int value, int count)
+    {
+        while(count--)
+        {
+            acc=(acc<<1)|((value>>count)&1);
+            if(++nbBits==8)
+            {
+                out.push_back(acc);
+                acc=0;
+                nbBits=0;
+            }
+        }
+    }
+    void flush()
+    {
+        if(nbBits)
+            out.push_back(acc<<(8-nbBits));
+        acc=0;
+        nbBits=0;
+    }
+protected:
+    std::vector<uint8_t> &out;
+    int     acc;
+    int     nbBits;
+};
+
+/**
+ * Heatshrink bitstream, but back references can go before the glyph, into
+ * the dictionary. The dictionary is constant, so any glyph can still be decoded on its own.
+ * Optimal parse over the longest match found at each position, matches are
+ * searched through hash chains, at most FC_HS_MAX_CHAIN candidates per position
+ * @param in
+ * @param dict
+ * @param windowBits
+ * @param lookaheadBits
+ * @param out
+ * @return
+ */
+#define FC_HASH_BITS 12
+bool FontConverter::compressWithDictionary(const std::vector<uint8_t> &in, const std::vector<uint8_t> &dict,
+                                           int windowBits, int lookaheadBits, std::vector<uint8_t> &out)
+{
+    const int window=1<<windowBits;
+    const int maxLen=1<<lookaheadBits;
+    const int refCost=1+windowBits+lookaheadBits;
+    const int literalCost=9;
+    int dictSize=dict.size();
+    int n=in.size();
+    // dictionary immediately followed by the glyph
+    std::vector<uint8_t> all(dict);
+    all.insert(all.end(),in.begin(),in.end());
+    int total=all.size();
+
+    // hash chains on 2 bytes
+    std::vector<int> head(1<<FC_HASH_BITS,-1);
+    std::vector<int> prev(total,-1);
+    auto hash=[&](int p) { return ((all[p]<<4)^all[p+1])&((1<<FC_HASH_BITS)-1); };
+
+    std::vector<int> cost(n+1,0), length(n+1,0), index(n+1,0);
+    std::vector<int> longest(n,0), longestIndex(n,0);
+    for(int pos=0;pos+1<total;pos++)
+    {
+        int h=hash(pos);
+        int i=pos-dictSize;
+        if(i>=0)
+        {
+            int bestLen=0,bestIndex=0,tries=0;
+            for(int j=head[h];j>=0 && pos-j<=window && tries<FC_HS_MAX_CHAIN;j=prev[j],tries++)
+            {
+                int l=0;
+                while(l<maxLen && i+l<n && all[j+l]==all[pos+l]) l++;
+                if(l>bestLen)
+                {
+                    bestLen=l;
+                    bestIndex=pos-j;
+                    if(l==maxLen) break;
+                }
+            }
+            longest[i]=bestLen;
+            longestIndex[i]=bestIndex;
+        }
+        prev[pos]=head[h];
+        head[h]=pos;
+    }
+    for(int i=n-1;i>=0;i--)
+    {
+        cost[i]=literalCost+cost[i+1];
+        length[i]=0;
+        for(int l=2;l<=longest[i];l++)
+        {
+            int c=refCost+cost[i+l];
+            if(c<cost[i])
+            {
+                cost[i]=c;
+                length[i]=l;
+                index[i]=longestIndex[i];
+            }
+        }
+    }
+    out.clear();
+    BitWriter writer(out);
+    int i=0;
+    while(i<n)
+    {
+        if(!length[i])
+        {
+            writer.put(1,1);
+            writer.put(in[i],8);
+            i++;
+            continue;
+        }
+        writer.put(0,1);
+        writer.put(index[i]-1,windowBits);
+        writer.put(length[i]-1,lookaheadBits);
+        i+=length[i];
+    }
+    writer.flush();
+    return true;
+}
+/**
+ * 
+ * @param window
+ * @return dictionary size for that many window bits
+ */
+int FontConverter::dictionarySize(int window)
+{
+    int sz=1<<window;
+    return sz<FC_DICTIONARY_SIZE ? sz : FC_DICTIONARY_SIZE;
+}
+
+/**
+ * Build the shared dictionary from the font itself :
+ * pick the chunks of glyph data whose short sequences appear in the largest
+ * number of glyphs, the most useful chunk being put last, i.e. the closest to the glyph
+ * @param glyphs
+ * @param maxSize
+ * @param dictionary
+ */
+#define FC_DICTIONARY_KGRAM 4
+void FontConverter::buildDictionary(const std::vector<EncodedGlyph> &glyphs, int maxSize, std::vector<uint8_t> &dictionary)
+{
+    const int K=FC_DICTIONARY_KGRAM;
+    const int S=FC_DICTIONARY_SEGMENT;
+    std::unordered_map<uint32_t,int> ids;
+    std::vector<int> counts;
+    std::vector<std::vector<int> > positions(glyphs.size()); // k-gram id at each position
+    for(int g=0;g<(int)glyphs.size();g++)
+    {
+        const std::vector<uint8_t> &raw=glyphs[g].raw;
+        int n=raw.size()-K+1;
+        if(n<=0) continue;
+        std::vector<int> &pos=positions[g];
+        pos.resize(n);
+        std::vector<int> seen;
+        for(int p=0;p<n;p++)
+        {
+            uint32_t key=((uint32_t)raw[p]<<24)|(raw[p+1]<<16)|(raw[p+2]<<8)|raw[p+3];
+            auto it=ids.find(key);
+            int id;
+            if(it==ids.end())
+            {
+                id=counts.size();
+                ids[key]=id;
+                counts.push_back(0);
+            }else
+                id=it->second;
+            pos[p]=id;
+            seen.push_back(id);
+        }
+        // count each k-gram once per glyph
+        std::sort(seen.begin(),seen.end());
+        seen.erase(std::unique(seen.begin(),seen.end()),seen.end());
+        for(int i=0;i<(int)seen.size();i++)
+            counts[seen[i]]++;
+    }
+    std::vector<std::vector<uint8_t> > chunks;
+    int total=0;
+    while(total+K<=maxSize)
+    {
+        int budget=maxSize-total;
+        int seg=S<budget ? S : budget;
+        int bestScore=0,bestGlyph=-1,bestStart=0,bestSize=0;
+        for(int g=0;g<(int)glyphs.size();g++)
+        {
+            const std::vector<int> &pos=positions[g];
+            int rawSize=glyphs[g].raw.size();
+            if(!pos.size()) continue;
+            int size=seg<rawSize ? seg : rawSize;
+            int inside=size-K+1; // k-grams fully inside the chunk
+            // sliding sum of the k-gram counts, only the shared ones are worth anything
+            int score=0;
+            for(int p=0;p<inside;p++)
+                if(counts[pos[p]]>1) score+=counts[pos[p]];
+            for(int start=0;;start++)
+            {
+                if(score>bestScore)
+                {
+                    bestScore=score;
+                    bestGlyph=g;
+                    bestStart=start;
+                    bestSize=size;
+                }
+                if(start+size>=rawSize) break;
+                if(counts[pos[start]]>1) score-=counts[pos[start]];
+                int in=pos[start+inside];
+                if(counts[in]>1) score+=counts[in];
+            }
+        }
+        if(bestGlyph<0) break;
+        const std::vector<uint8_t> &raw=glyphs[bestGlyph].raw;
+        chunks.push_back(std::vector<uint8_t>(raw.begin()+bestStart,raw.begin()+bestStart+bestSize));
+        total+=bestSize;
+        // those are now covered
+        const std::vector<int> &pos=positions[bestGlyph];
+        for(int p=bestStart;p<=bestStart+bestSize-K;p++)
+            counts[pos[p]]=0;
+    }
+    dictionary.clear();
+    for(int i=chunks.size()-1;i>=0;i--)
+        dictionary.insert(dictionary.end(),chunks[i].begin(),chunks[i].end());
+}
+
+/**
+ * Decode the compressed glyph back with the reference decoder, make sure
+ * we get the original back
+ * @param e
+ * @return
+ */
+bool FontConverter::checkCompressed(EncodedGlyph &e)
+{
+    PFXfont font;
+    describeFont(font);
+    std::vector<uint8_t> decoded(e.raw.size()+1);
+    PFXglyph stored=storedGlyph(e);
+    int got=pfxDecodeGlyph(&font,&stored,e.data.data(),decoded.data(),NULL);
+    if(got!=(int)e.raw.size() || memcmp(decoded.data(),e.raw.data(),got))
+    {
+        static const char *encodings[]={"raw","RLE","heatshrink","dictionary"};
+        int encoding= adaptive ? (e.glyph.flags&PFX_GLYPH_ENCODING_MASK) : useDictionary ? PFX_GLYPH_DICTIONARY : PFX_GLYPH_HEATSHRINK;
+        printf("Compressed glyph (%dx%d, %s) does not decode back to the original\n",e.glyph.width,e.glyph.height,encodings[encoding]);
+        return false;
+    }
+    return true;
+}
+/**
+ * Draw every glyph of the font as it will be emitted (glyph table, ranges,
+ * offset bases, bitmap) with pfxrender.h, and check the pixels against
+ * what FreeType gave us. The decode counters of each glyph give the cost
+ * estimate printed in the footer
+ * @param encoded
+ * @return
+ */
+bool FontConverter::verifyGlyphs(const std::vector<EncodedGlyph> &encoded)
+{
+    if(atlasWidth)
+        return verifyAtlas(encoded);
+    std::vector<PFXglyph> table;
+    std::vector<PFXrange> ranges;
+    PFXfont font;
+    describeIndex(font,table,ranges);
+    font.bitmap=(uint8_t *)bitPusher.data();
+
+    std::vector<uint8_t> scratch(pfxMaxGlyphSize(&font)+1);
+    std::vector<uint8_t> pixels;
+    for(int i=0;i<(int)codePoints.size();i++)
+    {
+        const EncodedGlyph &e=encoded[i];
+        if(!e.rendered || !e.glyph.width || !e.glyph.height) continue;
+        const PFXglyph *glyph=pfxGetGlyph(&font,codePoints[i]);
+        if(!glyph)
+        {
+            printf("Glyph 0x%x missing from the font\n",codePoints[i]);
+            return false;
+        }
+        if(!verifyGlyph(font,glyph,e,codePoints[i],scratch,pixels))
+            return false;
+    }
+    return true;
+}
+/**
+ * Draw one glyph back from font and compare it with what FreeType gave,
+ * the decode counters go to the footer estimate
+ * @param font
+ * @param glyph
+ * @param e
+ * @param code
+ * @param scratch at least pfxGlyphSize() bytes
+ * @param pixels
+ * @return
+ */
+bool FontConverter::verifyGlyph(const PFXfont &font, const PFXglyph *glyph, const EncodedGlyph &e, uint32_t code,
+                                std::vector<uint8_t> &scratch, std::vector<uint8_t> &pixels)
+{
+    int max=(1<<bpp)-1;
+    int w=glyph->width,h=glyph->height;
+    PFXdecodeStats st;
+    memset(&st,0,sizeof(st));
+    bool rgb=(format==PFX_FORMAT_RGB332 || format==PFX_FORMAT_RGB565);
+    if(rgb)
+    {
+        // not drawn on the CPU, the decoded glyph is what the display gets
+        int got=pfxDecodeGlyph(&font,glyph,pfxGlyphBitmap(&font,glyph),scratch.data(),&st);
+        if(got!=(int)e.raw.size() || memcmp(scratch.data(),e.raw.data(),got))
+        {
+            printf("Glyph 0x%x does not decode as rendered\n",code);
+            return false;
+        }
+        st.pixelsWritten=w*h;
+    }else
+    {
+        pixels.assign(w*h,0);
+        PFXframebuffer fb={pixels.data(),w,h,w};
+        if(pfxDrawGlyph(&font,glyph,&fb,-glyph->xOffset,-glyph->yOffset,scratch.data(),&st)<0)
+        {
+            printf("Glyph 0x%x does not decode\n",code);
+            return false;
+        }
+        for(int p=0;p<w*h;p++)
+        {
+            int x=p%w,y=p/w;
+            int level;
+            if(format==PFX_FORMAT_PAGE)
+                level=pfxPagePixel(e.raw.data(),w,x,y)*255;
+            else if(y>=e.gapStart && y<e.gapStart+e.gapLength)
+                level=0;
+            else
+            {
+                if(e.gapLength && y>=e.gapStart) y-=e.gapLength;
+                level=pfxPackedPixel(e.raw.data(),y*w+x,bpp)*255/max;
+            }
+            if(pixels[p]!=level)
+            {
+                printf("Glyph 0x%x is not drawn as rendered\n",code);
+                return false;
+            }
+        }
+    }
+    int decode=st.bitsRead*FC_CYCLES_PER_BIT
+              +st.bytesOut*FC_CYCLES_PER_BYTE
+              +(st.literals+st.backRefs+st.runs)*FC_CYCLES_PER_TOKEN;
+    int draw=decode;
+    if(!rgb)
+        draw+=w*h*FC_CYCLES_PER_PIXEL+st.pixelsWritten*FC_CYCLES_PER_WRITE;
+    _totalDecodeCycles+=decode;
+    _totalDrawCycles+=draw;
+    if(decode>_maxDecodeCycles) _maxDecodeCycles=decode;
+    if(draw>_maxDrawCycles) _maxDrawCycles=draw;
+    _drawStats.bitsRead+=st.bitsRead;
+    _drawStats.literals+=st.literals;
+    _drawStats.backRefs+=st.backRefs;
+    _drawStats.bytesCopied+=st.bytesCopied;
+    _drawStats.runs+=st.runs;
+    _drawStats.bytesRead+=st.bytesRead;
+    _drawStats.bytesOut+=st.bytesOut;
+    _drawStats.pixelsWritten+=st.pixelsWritten;
+    _drawStats.glyphs+=st.glyphs;
+    return true;
+}
+/**
+ * Streaming : the glyphs were drawn back one by one as they were written,
+ * check that the index as emitted (glyph table, ranges, offset bases) finds
+ * each of them where it was written
+ * @return
+ */
+bool FontConverter::verifyIndex()
+{
+    std::vector<PFXglyph> table;
+    std::vector<PFXrange> ranges;
+    PFXfont font;
+    describeIndex(font,table,ranges);
+    for(int i=0;i<(int)codePoints.size();i++)
+    {
+        const PFXglyph &g=listOfGlyphs[i];
+        if(!g.width || !g.height) continue;
+        const PFXglyph *glyph=pfxGetGlyph(&font,codePoints[i]);
+        if(!glyph || glyph->width!=g.width || glyph->height!=g.height)
+        {
+            printf("Glyph 0x%x missing from the font\n",codePoints[i]);
+            return false;
+        }
+        // pfxGlyphBitmap() without a bitmap to point into
+        uint32_t offset=glyph->bitmapOffset;
+        if(font.offsetBase)
+            offset+=font.offsetBase[(glyph-font.glyph)>>font.offsetBlockShift];
+        if(offset!=bitmapOffsets[i])
+        {
+            printf("Glyph 0x%x does not point to its bitmap\n",codePoints[i]);
+            return false;
+        }
+    }
+    return true;
+}
+/**
+ * The PFXfont as emitted, minus the bitmap
+ * @param font
+ * @param table filled, font points into it
+ * @param ranges same
+ */
+void FontConverter::describeIndex(PFXfont &font, std::vector<PFXglyph> &table, std::vector<PFXrange> &ranges)
+{
+    buildGlyphTable(table);
+    if(sparse)
+        buildRanges(ranges);
+    describeFont(font);
+    font.glyph=table.data();
+    font.first=first>0xFFFF ? 0xFFFF : first;
+    font.last=last>0xFFFF ? 0xFFFF : last;
+    font.ranges=ranges.size() ? ranges.data() : NULL;
+    font.nbRanges=ranges.size();
+    font.offsetBase=offsetBases.size() ? offsetBases.data() : NULL;
+    font.offsetBlockShift=offsetBlockShift;
+}
+/**
+ * 
+ * @return what goes in PFXfont::shrinked
+ */
+int FontConverter::shrinkMode()
+{
+    if(!compressed) return PFX_SHRINK_NONE;
+    if(adaptive) return PFX_SHRINK_ADAPTIVE;
+    if(useDictionary) return PFX_SHRINK_DICTIONARY;
+    return PFX_SHRINK_HEATSHRINK;
+}
+/**
+ * The PFXfont the device will see, minus the bitmap & glyphs
+ * @param font
+ */
+void FontConverter::describeFont(PFXfont &font)
+{
+    memset(&font,0,sizeof(font));
+    font.bpp=storedBpp();
+    font.shrinked=shrinkMode();
+    font.dictionary=dictionary.size() ? dictionary.data() : NULL;
+    font.dictionarySize=dictionary.size();
+    font.hsWindow=hsWindow;
+    font.hsLookahead=hsLookahead;
+}
+// EOF
@@ -0,0 +1,240 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "flatconvert.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include "algorithm"
+
+/**
+ * 
+ */
+CorpusScanner::CorpusScanner()
+{
+    counts.assign(0x10000,0);
+    total=0;
+    invalid=0;
+}
+/**
+ * Count one decoded code point
+ * @param c
+ */
+void CorpusScanner::add(uint32_t c)
+{
+    if(c<0x10000)
+        counts[c]++;
+    else
+        supplementary[c]++;
+    total++;
+}
+/**
+ * Decode & count a chunk of UTF-8. ASCII, the bulk of string tables and
+ * sources, is checked 16 bytes at a time (8 without SSE2/NEON) and counted
+ * without going through the decoder
+ * @param data
+ * @param size
+ * @param last true for the end of the file, an unfinished sequence is invalid
+ * @return bytes consumed, the unfinished sequence at the end of the chunk is not
+ */
+int CorpusScanner::scan(const uint8_t *data, int size, bool last)
+{
+    const uint8_t *p=data;
+    const uint8_t *end=data+size;
+    uint64_t *ascii=counts.data();
+    while(p<end)
+    {
+#if defined(__SSE2__)
+        while(end-p>=16 && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p)))
+        {
+            for(int i=0;i<16;i++) ascii[p[i]]++;
+            total+=16;
+            p+=16;
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        while(end-p>=16 && vmaxvq_u8(vld1q_u8(p))<0x80)
+        {
+            for(int i=0;i<16;i++) ascii[p[i]]++;
+            total+=16;
+            p+=16;
+        }
+#else
+        uint64_t word;
+        while(end-p>=8 && (memcpy(&word,p,8),!(word&0x8080808080808080ULL)))
+        {
+            for(int i=0;i<8;i++) ascii[p[i]]++;
+            total+=8;
+            p+=8;
+        }
+#endif
+        if(p>=end) break;
+        uint32_t c=*p;
+        if(c<0x80)
+        {
+            ascii[c]++;
+            total++;
+            p++;
+            continue;
+        }
+        int extra;
+        uint32_t min;
+        if((c&0xE0)==0xC0)      { extra=1;c&=0x1F;min=0x80;}
+        else if((c&0xF0)==0xE0) { extra=2;c&=0x0F;min=0x800;}
+        else if((c&0xF8)==0xF0) { extra=3;c&=0x07;min=0x10000;}
+        else
+        {
+            invalid++;
+            p++;
+            continue;
+        }
+        int avail=end-p-1;
+        int i;
+        for(i=0;i<extra && i<avail;i++)
+        {
+            if((p[1+i]&0xC0)!=0x80) break;
+            c=(c<<6)|(p[1+i]&0x3F);
+        }
+        if(i<extra)
+        {
+            if(i==avail && !last) break; // finished by the next chunk
+            invalid++;                   // resync on the byte that broke it
+            p++;
+            continue;
+        }
+        if(c<min || c>FC_MAX_CODEPOINT || (c>=0xD800 && c<=0xDFFF))
+        {
+            invalid++;
+            p++;
+            continue;
+        }
+        add(c);
+        p+=1+extra;
+    }
+    return p-data;
+}
+/**
+ * Scan a whole file, FC_CORPUS_CHUNK bytes at a time
+ * @param file
+ * @param error
+ * @return false if the file cannot be read
+ */
+bool CorpusScanner::scanFile(const std::string &file, std::string &error)
+{
+    FILE *f=fopen(file.c_str(),"rb");
+    if(!f)
+    {
+        error="cannot open corpus file "+file;
+        return false;
+    }
+    std::vector<uint8_t> buffer(FC_CORPUS_CHUNK+4);
+    int carry=0;
+    int64_t before=invalid;
+    while(1)
+    {
+        int nb=fread(buffer.data()+carry,1,FC_CORPUS_CHUNK,f);
+        int size=carry+nb;
+        bool last=nb<FC_CORPUS_CHUNK;
+        int done=scan(buffer.data(),size,last);
+        carry=size-done; // at most 3 bytes
+        if(carry) memmove(buffer.data(),buffer.data()+done,carry);
+        if(last) break;
+    }
+    bool ok=!ferror(f);
+    fclose(f);
+    if(!ok)
+    {
+        error="cannot read corpus file "+file;
+        return false;
+    }
+    if(invalid>before)
+        printf("Warning : %s : %d invalid UTF-8 bytes skipped\n",file.c_str(),(int)(invalid-before));
+    return true;
+}
+/**
+ * The code points seen, sorted, without the ones that are not glyphs
+ * (control characters, BOM)
+ * @param out
+ */
+void CorpusScanner::getCodePoints(std::vector<uint32_t> &out)
+{
+    for(uint32_t c=0x20;c<0x10000;c++)
+    {
+        if(!counts[c]) continue;
+        if(c==0x7F || (c>=0x80 && c<0xA0) || c==0xFEFF) continue;
+        out.push_back(c);
+    }
+    for(auto &s : supplementary)
+        out.push_back(s.first);
+}
+/**
+ * One line per code point, most used first, so that the hot glyphs can be
+ * laid out or cached first on the device :
+ *   U+0065 123456 8.12 e
+ * code point, count, share of the corpus in %, the char itself
+ * @param file
+ * @return false on write error
+ */
+bool CorpusScanner::writeFrequencies(const std::string &file)
+{
+    std::vector<uint32_t> used;
+    getCodePoints(used);
+    std::vector<std::pair<uint64_t,uint32_t>> sorted;
+    for(uint32_t c : used)
+        sorted.push_back(std::make_pair(c<0x10000 ? counts[c] : supplementary[c],c));
+    std::stable_sort(sorted.begin(),sorted.end(),
+            [](const std::pair<uint64_t,uint32_t> &a, const std::pair<uint64_t,uint32_t> &b) {return a.first>b.first;});
+
+    std::string text;
+    char line[96];
+    sprintf(line,"# %lld code points, %d distinct, %lld invalid bytes\n",(long long)total,(int)sorted.size(),(long long)invalid);
+    text+=line;
+    for(auto &s : sorted)
+    {
+        sprintf(line,"U+%04X %llu %.2f ",s.second,(unsigned long long)s.first,total ? 100.*s.first/total : 0.);
+        text+=line;
+        text+=FontConverter::printable(s.second)+"\n";
+    }
+    return writeIfChanged(file,(const uint8_t *)text.data(),text.size());
+}
+
+/**
+ * Comma separated list of files
+ * @param value
+ * @param out
+ * @return false if empty
+ */
+bool parseFileList(const std::string &value, std::vector<std::string> &out)
+{
+    out.clear();
+    std::string::size_type start=0;
+    while(start<=value.size())
+    {
+        std::string::size_type comma=value.find(',',start);
+        if(comma==std::string::npos) comma=value.size();
+        std::string name=value.substr(start,comma-start);
+        while(name.size() && name[0]==' ') name.erase(0,1);
+        while(name.size() && name[name.size()-1]==' ') name.erase(name.size()-1);
+        if(name.size()) out.push_back(name);
+        start=comma+1;
+    }
+    return out.size()>0;
+}
+// EOF
@@ -17,6 +17,13 @@ Keep 7-bit fonts around as an option in that case, more compact.
 See notes at end for glyph nomenclature & other tidbits.
 */
 #include "flatconvert.h"
+#include "thread"
+#include "atomic"
+#include "memory"
+#include "algorithm"
+#include "functional"
+#include "unordered_map"
+#include "sys/stat.h"
 
 
 /**
@@ -29,31 +36,66 @@ See notes at end for glyph nomenclature & other tidbits.
     fontFile=xfontFile;
     symbolName=xsymbolName;
     outputFile=xoutputFile;
-    ftInited=false;
+    faces=NULL;
     face_height=0;
+    face=NULL;
     output=NULL;
+    ownOutput=false;
     compressed=false;
+    useDictionary=false;
+    adaptive=false;
+    dedup=false;
+    format=0;
+    fgColor=0xFFFFFF;
+    bgColor=0;
+    rotation=0;
+    trim=false;
+    trimGaps=false;
+    atlasWidth=atlasHeight=0;
+    atlasAlign=FC_ATLAS_ALIGN;
+    atlasPageHeight=atlasStride=atlasPages=0;
+    kerning=false;
+    glyphStats=false;
+    streaming=false;
+    spool=NULL;
+    spoolSize=0;
+    offsetBlockShift=0;
+    _dedupGlyphs=0;
+    _dedupBytes=0;
+    _trimGlyphs=_trimBytes=_gapGlyphs=_gapBytes=0;
+    hsWindow=FC_HS_WINDOW;
+    hsLookahead=FC_HS_LOOKAHEAD;
+    hsSearch=false;
+    hsRamBudget=0;
     _totalUncompressedSize=0;
+    _totalDecodeCycles=_totalDrawCycles=0;
+    _maxDecodeCycles=_maxDrawCycles=0;
+    memset(&_drawStats,0,sizeof(_drawStats));
+    nbThreads=1;
+    fontSize=0;
  }
  FontConverter::~FontConverter()
  {
-    if(ftInited)
-        FT_Done_FreeType(library);
-    if(output)
+    if(output && ownOutput)
     {
         fclose(output);
         output=NULL;
     }
+    if(spool)
+    {
+        fclose(spool);
+        spool=NULL;
+    }
  }
  /**
   *
   * @param c
   * @return
   */
- char FontConverter::printable(int c)
+ std::string FontConverter::printable(uint32_t c)
  {
-     if(c<' ') return '.';
-     return (char )c;
+     if(c<' ') return std::string(".");
+     return utf8Encode(c);
  }
 
 
@@ -61,11 +103,14 @@ See notes at end for glyph nomenclature & other tidbits.
   *
   * @return
   */
-bool    FontConverter::initFreeType(int size)
+bool    FacePool::openFace(int size, FT_Library &library, FT_Face &face, double &initMs)
 {
   int err;
   // Init FreeType lib, load font
-  if ((err = FT_Init_FreeType(&library)))
+  auto start=std::chrono::steady_clock::now();
+  err = FT_Init_FreeType(&library);
+  initMs=fcElapsedMs(start);
+  if (err)
   {
     fprintf(stderr, "FreeType init error: %d", err);
     return false;
@@ -77,50 +122,227 @@ bool    FontConverter::initFreeType(int size)
   // See https://github.com/adafruit/Adafruit-GFX-Library/issues/103
   FT_UInt interpreter_version = TT_INTERPRETER_VERSION_35;
   FT_Property_Set(library, "truetype", "interpreter-version", &interpreter_version);
-  // prepare names
-  ftInited=true;
-  if ((err = FT_New_Face(library, fontFile.c_str(), 0, &face)))
+  if (fontData)
+    err = FT_New_Memory_Face(library, fontData, fontDataSize, 0, &face);
+  else
+    err = FT_New_Face(library, fontFile.c_str(), 0, &face);
+  if (err)
   {
-    fprintf(stderr, "Font load error: %d", err);
+    fprintf(stderr, "Font load error: %d (%s)\n", err,fontFile.c_str());
     FT_Done_FreeType(library);
-    return err;
+    face=NULL;
+    return false;
   }
 
   // << 6 because '26dot6' fixed-point format
   FT_Set_Char_Size(face, size << 6, 0, DPI, 0);
   return true;
 }
+/**
+ * 
+ * @param xfontFile
+ * @param data font already in memory, NULL : load xfontFile. It must stay there while the pool is used
+ * @param dataSize
+ */
+FacePool::FacePool(const std::string &xfontFile, const uint8_t *data, int dataSize)
+{
+  fontFile=xfontFile;
+  fontData=data;
+  fontDataSize=dataSize;
+}
+FacePool::~FacePool()
+{
+  for(int i=0;i<(int)slots.size();i++)
+  {
+    if(!slots[i].face) continue;
+    FT_Done_Face(slots[i].face);
+    FT_Done_FreeType(slots[i].library);
+  }
+}
+/**
+ * Call before starting the workers, each worker then only touches its own slot
+ * @param nb
+ */
+void    FacePool::reserve(int nb)
+{
+  Slot empty;
+  empty.face=NULL;
+  empty.initMs=0;
+  if((int)slots.size()<nb) slots.resize(nb,empty);
+}
+/**
+ * Face of that worker, loaded on first use, set to that size
+ * Other sizes get their own FT_Size, kept with the face, instead of reloading it
+ * @param worker
+ * @param size
+ * @return NULL on error
+ */
+FT_Face FacePool::activate(int worker, int size)
+{
+  Slot &s=slots[worker];
+  if(!s.face)
+  {
+    if(!openFace(size,s.library,s.face,s.initMs))
+    {
+      s.face=NULL;
+      return NULL;
+    }
+    s.sizes[size]=s.face->size;
+    return s.face;
+  }
+  auto it=s.sizes.find(size);
+  if(it!=s.sizes.end())
+  {
+    if(s.face->size!=it->second) FT_Activate_Size(it->second);
+    return s.face;
+  }
+  FT_Size ftSize;
+  int err;
+  if((err=FT_New_Size(s.face,&ftSize)))
+  {
+    fprintf(stderr, "FreeType size error: %d\n", err);
+    return NULL;
+  }
+  FT_Activate_Size(ftSize);
+  FT_Set_Char_Size(s.face, size << 6, 0, DPI, 0);
+  s.sizes[size]=ftSize; // freed with the face
+  return s.face;
+}
+/**
+ * Time spent in FT_Init_FreeType by all the faces so far
+ * @return ms
+ */
+double FacePool::initMs()
+{
+  double ms=0;
+  for(int i=0;i<(int)slots.size();i++)
+    ms+=slots[i].initMs;
+  return ms;
+}
+/**
+ * Rough memory held by the pool : the font file is parsed once per face
+ * @return bytes
+ */
+int64_t FacePool::memoryCost()
+{
+  int64_t perFace=fontData ? fontDataSize : 0;
+  if(!fontData)
+  {
+    struct stat st;
+    if(!stat(fontFile.c_str(),&st)) perFace=st.st_size;
+  }
+  int64_t cost=0;
+  for(int i=0;i<(int)slots.size();i++)
+    if(slots[i].face) cost+=perFace+FC_FACE_OVERHEAD*(int64_t)slots[i].sizes.size();
+  return cost;
+}
+ /**
+  *
+  * @return
+  */
+bool    FontConverter::initFreeType(int size)
+{
+  fontSize=size;
+  if(!faces)
+  {
+    ownFaces.reset(new FacePool(fontFile));
+    faces=ownFaces.get();
+  }
+  faces->reserve(1);
+  double initBefore=faces->initMs();
+  auto start=std::chrono::steady_clock::now();
+  face=faces->activate(0,size);
+  stats.loadMs+=fcElapsedMs(start);
+  stats.initMs+=faces->initMs()-initBefore;
+  return face!=NULL;
+}
 /**
  *
  * @param size
  * @return
  */
-bool    FontConverter::init(int size, int bpp,int xfirst, int xlast, int *mapp)
+bool    FontConverter::init(int size, int bpp,const std::vector<uint32_t> &xcodePoints, bool xsparse)
 {
     this->bpp=bpp;
-    this->_mapp=mapp;
-    if(!initFreeType(size)) return false;
-    if(xlast>xfirst)
+    stats.symbol=symbolName;
+    stats.size=size;
+    stats.bpp=bpp;
+    if(!xcodePoints.size())
     {
-      first=xfirst;
-      last=xlast;
-    }else
+        fprintf(stderr, "no glyph to convert\n");
+        return false;
+    }
+    codePoints=xcodePoints;
+    std::sort(codePoints.begin(),codePoints.end());
+    codePoints.erase(std::unique(codePoints.begin(),codePoints.end()),codePoints.end());
+    first=codePoints.front();
+    last=codePoints.back();
+    sparse=sparseLayout(codePoints,xsparse);
+    if(sparse && codePoints.size()>FC_MAX_SPARSE_GLYPHS)
     {
-       first=xlast;
-       last=xfirst ;
+        fprintf(stderr, "%d glyphs, sparse fonts hold at most %d\n",(int)codePoints.size(),FC_MAX_SPARSE_GLYPHS);
+        return false;
     }
-
-
-
+    int saving=sparse ? 0 : sparseSaving(codePoints);
+    if(saving>0)
+        printf("Note : -u (sparse glyph index, look glyphs up with pfxGetGlyph) would save %d bytes\n",saving);
+    if(!initFreeType(size)) return false;
+    if(output) return true; // attached
     output=fopen(outputFile.c_str(),"wb");
     if(!output)
     {
          fprintf(stderr, "cannot open %s file\n", outputFile.c_str());
          return false;
     }
+    ownOutput=true;
     return true;
 }
 
+/**
+ * Sparse when asked, or when the code points go above 0xFFFF (PFXfont first/last
+ * are 16 bits). Otherwise dense, even if sparse would be smaller : existing code
+ * indexes glyph[c - first] directly
+ * @param codePoints sorted, no duplicates
+ * @param forced -u
+ * @return
+ */
+bool FontConverter::sparseLayout(const std::vector<uint32_t> &codePoints, bool forced)
+{
+    return forced || codePoints.back()>0xFFFF;
+}
+/**
+ * Bytes -u would save on the glyph index, 0 if none
+ * @param codePoints sorted, no duplicates
+ * @return
+ */
+int FontConverter::sparseSaving(const std::vector<uint32_t> &codePoints)
+{
+    int nbRanges=1;
+    for(int i=1;i<(int)codePoints.size();i++)
+        if(codePoints[i]!=codePoints[i-1]+1) nbRanges++;
+    int64_t dense=(int64_t)(codePoints.back()-codePoints.front()+1)*sizeof(PFXglyph);
+    int64_t runs=codePoints.size()*sizeof(PFXglyph)+nbRanges*sizeof(PFXrange);
+    return dense>runs ? (int)(dense-runs) : 0;
+}
+/**
+ * The whole font, timed
+ * @param withHeader false for the next fonts of the same file
+ */
+void   FontConverter::printFont(bool withHeader)
+{
+    auto start=std::chrono::steady_clock::now();
+    long before=ftell(output);
+    if(withHeader)
+        printHeader();
+    printBitmap();
+    printIndex();
+    printFooter();
+    if(atlasWidth)
+        printAtlas();
+    fflush(output);
+    stats.emitMs=fcElapsedMs(start);
+    stats.emitBytes=ftell(output)-before;
+}
 /**
  *
  */
@@ -136,60 +358,378 @@ void   FontConverter::printHeader()
    */
 void   FontConverter::printIndex()
 {
-  fprintf(output,"const PFXglyph %sGlyphs[] PROGMEM = {\n", symbolName.c_str());
-  for(int i = first;i <= last; i++)
+  if(isShared("Glyphs"))
+  {
+    fprintf(output,"// %sGlyphs : same as %s\n", symbolName.c_str(),arrayName("Glyphs").c_str());
+  }else
+  {
+    std::vector<PFXglyph> table;
+    buildGlyphTable(table);
+    fprintf(output,"const PFXglyph %sGlyphs[] PROGMEM = {\n", symbolName.c_str());
+    for(int i=0;i<(int)table.size();i++)
+      printGlyph(table[i],sparse ? codePoints[i] : first+i);
+    fprintf(output,"\n};\n");
+  }
+  printOffsetBases();
+  printKerning();
+  if(!sparse) return;
+
+  std::vector<PFXrange> ranges;
+  buildRanges(ranges);
+  fprintf(output,"const PFXrange %sRanges[] PROGMEM = {\n", symbolName.c_str());
+  for(int i=0;i<(int)ranges.size();i++)
+  {
+    fprintf(output,"  { 0x%04X, %5d, %5d},   // '%s'\n",
+           ranges[i].first,
+           ranges[i].count,
+           ranges[i].glyphIndex,
+           printable(ranges[i].first).c_str());
+  }
+  fprintf(output,"\n};\n");
+}
+/**
+ * The glyph array as emitted : one entry per code point between first & last,
+ * the ones not picked being empty, or one per code point for sparse fonts
+ * @param table
+ */
+void   FontConverter::buildGlyphTable(std::vector<PFXglyph> &table)
+{
+  if(sparse)
+  {
+    table=listOfGlyphs;
+    return;
+  }
+  PFXglyph zeroGlyph= (PFXglyph){0,0,0,0,0,0,0};
+  table.assign(last-first+1,zeroGlyph);
+  for(int i=0;i<(int)codePoints.size();i++)
+    table[codePoints[i]-first]=listOfGlyphs[i];
+}
+/**
+ * Large fonts only
+ */
+void   FontConverter::printOffsetBases()
+{
+  if(!offsetBases.size()) return;
+  fprintf(output,"const uint32_t %sOffsets[] PROGMEM = {\n ", symbolName.c_str());
+  for(int i=0;i<(int)offsetBases.size();i++)
   {
-    PFXglyph &glyph=listOfGlyphs[i-first];
-    fprintf(output,"  { %5d, %3d, %3d, %3d, %4d, %4d}",
+    fprintf(output," 0x%06X,",offsetBases[i]);
+    if((i&7)==7) fprintf(output,"\n ");
+  }
+  fprintf(output," };\n\n");
+}
+/**
+ *
+ */
+void   FontConverter::printGlyph(const PFXglyph &glyph, uint32_t code)
+{
+    fprintf(output,"  { %5d, %3d, %3d, %3d, %4d, %4d",
            glyph.bitmapOffset,
            glyph.width,
            glyph.height,
            glyph.xAdvance,
            glyph.xOffset,
            (int)glyph.yOffset);
-    fprintf(output,",   // 0x%02X '%c' \n", i,printable(i));
+    fprintf(output,", %3d}",glyph.flags);
+    fprintf(output,",   // 0x%02X '%s' \n", code,printable(code).c_str());
+}
+/**
+ * Group consecutive code points into runs
+ * @param ranges
+ */
+void   FontConverter::buildRanges(std::vector<PFXrange> &ranges)
+{
+  for(int i=0;i<(int)codePoints.size();i++)
+  {
+    if(ranges.size())
+    {
+      PFXrange &r=ranges.back();
+      if(r.first+r.count==codePoints[i] && r.count<0xFFFF)
+      {
+        r.count++;
+        continue;
+      }
+    }
+    PFXrange r;
+    r.first=codePoints[i];
+    r.count=1;
+    r.glyphIndex=i;
+    ranges.push_back(r);
   }
-   fprintf(output,"\n};\n");
 }
 
 bool FontConverter::saveBitmap(const char *bitmap)
 {
   printf("Saving bitmap to %s\n",bitmap);
-  FILE *f=fopen(bitmap,"wb");
-  if(!f)
+  bitPusher.align();
+  bool ok;
+  if(spool)
+    ok=writeSpooled(bitmap,std::vector<uint8_t>(),0);
+  else
+    ok=writeIfChanged(bitmap,bitPusher.data(),bitPusher.offset());
+  if(!ok)
+  {
+      printf("Error\n");
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Write the whole font as one binary blob, see pfxblob.h
+ * @param file
+ * @return 
+ */
+bool FontConverter::saveBlob(const char *file)
+{
+  printf("Saving blob to %s\n",file);
+  std::vector<uint8_t> blob;
+  bool ok;
+  if(spool) // the index then the streamed bitmap, never all in memory
+    ok=buildBlob(blob,false) && writeSpooled(file,blob,((spoolSize+3)&~3)-spoolSize);
+  else
+    ok=buildBlob(blob) && writeIfChanged(file,blob.data(),blob.size());
+  if(!ok)
   {
       printf("Error\n");
       return false;
   }
+  return true;
+}
+/**
+ * The whole font as one binary blob, see pfxblob.h
+ * @param blob
+ * @param withBitmap false : stop before the bitmap bytes, the header still counts them
+ * @return false if the header layout does not match pfxblob.h
+ */
+bool FontConverter::buildBlob(std::vector<uint8_t> &blob, bool withBitmap)
+{
+  std::vector<PFXglyph> table;
+  std::vector<PFXrange> ranges;
+  buildGlyphTable(table);
+  if(sparse)
+    buildRanges(ranges);
   bitPusher.align();
-  int sz=bitPusher.offset();
-  fwrite(bitPusher.data(),sz,1,f);
-  fclose(f);
+  bool customHs=compressed && (hsWindow!=FC_HS_WINDOW || hsLookahead!=FC_HS_LOOKAHEAD);
+
+  BlobWriter w;
+  w.u32(PFX_BLOB_MAGIC);
+  w.u16(PFX_BLOB_VERSION);
+  w.u16(sizeof(PFXblobHeader));
+  w.u32(0); // total size, patched below
+  w.u32(first);
+  w.u32(last);
+  w.u8(face_height ? face_height : listOfGlyphs[0].height);
+  w.u8(storedBpp());
+  w.u8(shrinkMode());
+  w.u8(customHs ? hsWindow : 0);
+  w.u8(customHs ? hsLookahead : 0);
+  w.u8(offsetBases.size() ? offsetBlockShift : 0);
+  w.u8(rotation);
+  w.u8(0);
+  int sections=w.data.size(); // offset/count pairs, patched below
+  for(int i=0;i<12;i++) w.u32(0);
+  if(w.data.size()!=sizeof(PFXblobHeader))
+  {
+      printf("Error : blob header size mismatch\n");
+      return false;
+  }
+
+  uint32_t glyphOffset=w.section();
+  for(int i=0;i<(int)table.size();i++)
+  {
+      const PFXglyph &g=table[i];
+      w.u16(g.bitmapOffset);
+      w.u8(g.width);
+      w.u8(g.height);
+      w.u8(g.xAdvance);
+      w.u8(g.xOffset);
+      w.u8(g.yOffset);
+      w.u8(g.flags);
+  }
+  uint32_t rangeOffset=0;
+  if(ranges.size())
+  {
+      rangeOffset=w.section();
+      for(int i=0;i<(int)ranges.size();i++)
+      {
+          w.u32(ranges[i].first);
+          w.u16(ranges[i].count);
+          w.u16(ranges[i].glyphIndex);
+      }
+  }
+  uint32_t offsetBaseOffset=0;
+  if(offsetBases.size())
+  {
+      offsetBaseOffset=w.section();
+      for(int i=0;i<(int)offsetBases.size();i++)
+          w.u32(offsetBases[i]);
+  }
+  uint32_t dictionaryOffset=0;
+  if(useDictionary && dictionary.size())
+  {
+      dictionaryOffset=w.section();
+      w.bytes(dictionary.data(),dictionary.size());
+  }
+  uint32_t kerningOffset=0;
+  if(kerningPairs.size())
+  {
+      kerningOffset=w.section();
+      for(int i=0;i<(int)kerningPairs.size();i++)
+          w.u32(kerningPairs[i]);
+      w.bytes((const uint8_t *)kerningValues.data(),kerningValues.size());
+  }
+  uint32_t bitmapOffset=w.section();
+  uint32_t bitmapBytes=bitmapSize();
+  uint32_t total=(bitmapOffset+bitmapBytes+3)&~3;
+  if(withBitmap)
+  {
+      if(spool)
+          readSpool([&](const uint8_t *chunk, int nb) {w.bytes(chunk,nb);return true;});
+      else
+          w.bytes(bitPusher.data(),bitPusher.offset());
+      w.section();
+  }
+
+  uint32_t fields[12]={glyphOffset,(uint32_t)table.size(),
+                       rangeOffset,(uint32_t)ranges.size(),
+                       offsetBaseOffset,(uint32_t)offsetBases.size(),
+                       dictionaryOffset,dictionaryOffset ? (uint32_t)dictionary.size() : 0,
+                       bitmapOffset,bitmapBytes,
+                       kerningOffset,(uint32_t)kerningPairs.size()};
+  for(int i=0;i<12;i++)
+      w.set32(sections+4*i,fields[i]);
+  w.set32(8,total);
+  blob.swap(w.data);
   return true;
 }
 
+/**
+ * Several fonts in one file : an array identical to one of an earlier font is
+ * not emitted again, the font points to the earlier one
+ * @param suffix Bitmaps, Glyphs or Dictionary
+ * @param owner symbol of the font holding it
+ */
+void FontConverter::shareArray(const char *suffix, const std::string &owner)
+{
+  sharedArrays[suffix]=owner;
+}
+bool FontConverter::isShared(const char *suffix)
+{
+  return sharedArrays.count(suffix)>0;
+}
+std::string FontConverter::arrayName(const char *suffix)
+{
+  auto it=sharedArrays.find(suffix);
+  if(it==sharedArrays.end()) return symbolName+suffix;
+  return it->second+suffix;
+}
+/**
+ * Copy of the bitmap as it will be emitted
+ * @param bitmap
+ */
+void FontConverter::getBitmap(std::vector<uint8_t> &bitmap)
+{
+  bitPusher.align();
+  if(spool)
+  {
+    bitmap.clear();
+    readSpool([&](const uint8_t *chunk, int nb) {bitmap.insert(bitmap.end(),chunk,chunk+nb);return true;});
+    return;
+  }
+  bitmap.assign(bitPusher.data(),bitPusher.data()+bitPusher.offset());
+}
+
 /**
  *
  */
 void FontConverter::printBitmap()
 {
-
-  fprintf(output,"const uint8_t %sBitmaps[] PROGMEM = {\n ", symbolName.c_str());
   bitPusher.align();
-  int sz=bitPusher.offset();
-  const uint8_t *data=bitPusher.data();
+  if(atlasWidth)
+    printByteArray("AtlasPixels",atlasPixels.data(),atlasPixels.size(),atlasAlign);
+  else if(incbinFile.size())
+    printIncbin("Bitmaps",incbinFile.c_str());
+  else
+    printByteArray("Bitmaps",spool ? NULL : bitPusher.data(),bitmapSize());
+  if(useDictionary)
+    printByteArray("Dictionary",dictionary.data(),dictionary.size());
+}
+/**
+ * Let the assembler pull the bitmap from the binary file instead of
+ * having the compiler parse it as a C initializer. The symbol is local
+ * to the including file, like the const arrays
+ * @param suffix
+ * @param file
+ */
+void FontConverter::printIncbin(const char *suffix, const char *file)
+{
+  fprintf(output,"extern const uint8_t %s%s[];\n", symbolName.c_str(),suffix);
+  fprintf(output,"__asm__(\".section " FC_INCBIN_SECTION ",\\\"a\\\"\\n\"\n");
+  fprintf(output,"        \".balign 4\\n\"\n");
+  fprintf(output,"        \"%s%s:\\n\"\n", symbolName.c_str(),suffix);
+  fprintf(output,"        \".incbin \\\"%s\\\"\\n\"\n", file);
+  fprintf(output,"        \".previous\\n\");\n\n");
+}
+/**
+ * Hex dump of a byte array, formatted by hand into a buffer written in
+ * big chunks : fprintf per byte is what used to dominate on large fonts
+ * @param suffix
+ * @param data NULL : the streamed bitmap, read back from the spool
+ * @param sz
+ * @param align when not 0, alignment of the array in bytes
+ */
+void FontConverter::printByteArray(const char *suffix, const uint8_t *data, int sz, int align)
+{
+  static const char hex[]="0123456789ABCDEF";
+  if(isShared(suffix))
+  {
+    fprintf(output,"// %s%s : same as %s\n\n", symbolName.c_str(),suffix,arrayName(suffix).c_str());
+    return;
+  }
+  if(align)
+    fprintf(output,"const uint8_t %s%s[] PROGMEM __attribute__((aligned(%d))) = {\n ", symbolName.c_str(),suffix,align);
+  else
+    fprintf(output,"const uint8_t %s%s[] PROGMEM = {\n ", symbolName.c_str(),suffix);
 
+  std::vector<char> text(FC_EMIT_CHUNK);
+  char *start=text.data();
+  char *limit=start+FC_EMIT_CHUNK-16; // room for one more byte and the line break
+  char *p=start;
   int tab=0;
-  for(int i=0;i<sz;i++)
+  auto add=[&](const uint8_t *bytes, int nb)
   {
-      fprintf(output," 0x%02X,",data[i]);
+    for(int i=0;i<nb;i++)
+    {
+      uint8_t d=bytes[i];
+      p[0]=' ';
+      p[1]='0';
+      p[2]='x';
+      p[3]=hex[d>>4];
+      p[4]=hex[d&0xf];
+      p[5]=',';
+      p+=6;
       tab++;
       if(tab==12)
       {
-          fprintf(output,"\n ");
+          p[0]='\n';
+          p[1]=' ';
+          p+=2;
           tab=0;
       }
-  }
+      if(p>=limit)
+      {
+          fwrite(start,p-start,1,output);
+          p=start;
+      }
+    }
+    return true;
+  };
+  if(data)
+    add(data,sz);
+  else
+    readSpool(add);
+  fwrite(start,p-start,1,output);
 
   fprintf(output," };\n\n"); // End bitmap array
 
@@ -203,139 +743,477 @@ void   FontConverter::printFooter()
 
   // Output font structure
   fprintf(output,"const PFXfont %s PROGMEM = {\n", symbolName.c_str());
-  fprintf(output,"  (uint8_t  *)%sBitmaps,\n", symbolName.c_str());
-  fprintf(output,"  (PFXglyph *)%sGlyphs,\n", symbolName.c_str());
+  if(atlasWidth)
+    fprintf(output,"  NULL, // pixels are in %sAtlasPixels\n", symbolName.c_str());
+  else
+    fprintf(output,"  (uint8_t  *)%s,\n", arrayName("Bitmaps").c_str());
+  fprintf(output,"  (PFXglyph *)%s,\n", arrayName("Glyphs").c_str());
+  // sparse fonts : first/last are informative only, clamped to 16 bits
+  int xfirst=first>0xFFFF ? 0xFFFF : first;
+  int xlast=last>0xFFFF ? 0xFFFF : last;
   if(!face_height)
   {  // No face height info, assume fixed width and get from a glyph.
-    fprintf(output,"  0x%02X, 0x%02X, %d,\n" , first, last, listOfGlyphs[0].height);
+    fprintf(output,"  0x%02X, 0x%02X, %d,\n" , xfirst, xlast, listOfGlyphs[0].height);
   }
   else
   {
-    fprintf(output,"  0x%02X, 0x%02X, %d, ", first, last, face_height);
+    fprintf(output,"  0x%02X, 0x%02X, %d, ", xfirst, xlast, face_height);
   }
-  fprintf(output,"\n  %1d,%1d}; // bit per pixel, compression \n\n",bpp,(int)compressed);
-  int sz=bitPusher.offset();
+  int shrink=shrinkMode();
+  std::string bppField=format ? formatName(format) : std::to_string(bpp);
+  std::vector<PFXrange> ranges;
+  if(sparse)
+    buildRanges(ranges);
+  bool customHs=compressed && (hsWindow!=FC_HS_WINDOW || hsLookahead!=FC_HS_LOOKAHEAD);
+  // every field is given, zero when unused, so that -Wmissing-field-initializers stays quiet
+  fprintf(output,"\n  %s,%1d, // bit per pixel, compression \n",bppField.c_str(),shrink);
+  if(sparse)
+    fprintf(output,"  (PFXrange *)%sRanges, %d, // code point runs \n",symbolName.c_str(),(int)ranges.size());
+  else
+    fprintf(output,"  NULL, 0, // code point runs \n");
+  if(useDictionary)
+    fprintf(output,"  (uint8_t  *)%s, %d, // compression dictionary \n",arrayName("Dictionary").c_str(),(int)dictionary.size());
+  else
+    fprintf(output,"  NULL, 0, // compression dictionary \n");
+  if(customHs)
+    fprintf(output,"  %d, %d, // heatshrink window, lookahead \n",hsWindow,hsLookahead);
+  else
+    fprintf(output,"  0, 0, // heatshrink window, lookahead \n");
+  if(offsetBases.size())
+    fprintf(output,"  (uint32_t *)%sOffsets, %d, // bitmap offset bases, glyphs per block = 1<<%d \n",symbolName.c_str(),offsetBlockShift,offsetBlockShift);
+  else
+    fprintf(output,"  NULL, 0, // bitmap offset bases \n");
+  fprintf(output,"  %d, // rotation, quarter turns clockwise \n",rotation);
+  if(kerningPairs.size())
+    fprintf(output,"  (uint32_t *)%sKerning, (int8_t *)%sKerningValues, %d, // kerning pairs \n",
+            symbolName.c_str(),symbolName.c_str(),(int)kerningPairs.size());
+  else
+    fprintf(output,"  NULL, NULL, 0, // kerning pairs \n");
+  fprintf(output,"};\n\n");
+  int sz=bitmapSize();
   if(compressed)
   {
     fprintf(output,"// Bitmap uncompressed : about %d bytes (%d kBytes)\n",_totalUncompressedSize,(_totalUncompressedSize+1023)/1024);    
   }
   fprintf(output,"// Bitmap output size   : about %d bytes (%d kBytes)\n",sz,(sz+1023)/1024);
-  if(compressed)
+  if(compressed && _totalUncompressedSize)
   {
     fprintf(output,"// compressed size : %d %%\n",(100*sz)/_totalUncompressedSize);
   }
+  if(compressed)
+  {
+    fprintf(output,"// heatshrink window %d, lookahead %d\n",hsWindow,hsLookahead);
+  }
+  if(useDictionary && _totalUncompressedSize)
+  {
+    int dsz=dictionary.size();
+    fprintf(output,"// Dictionary : %d bytes, with dictionary : %d %%\n",dsz,(100*(sz+dsz))/_totalUncompressedSize);
+  }
+  if(trim)
+  {
+    fprintf(output,"// Trimmed : %d glyphs cropped, %d bytes saved\n",_trimGlyphs.load(),_trimBytes.load());
+  }
+  if(trimGaps)
+  {
+    fprintf(output,"// Blank row runs left out : %d glyphs, %d bytes saved\n",_gapGlyphs.load(),_gapBytes.load());
+  }
+  if(dedup)
+  {
+    fprintf(output,"// Deduplicated : %d glyphs share an existing bitmap, %d bytes saved\n",_dedupGlyphs,_dedupBytes);
+  }
+  if(adaptive)
+  {
+    int count[4]={0,0,0,0};
+    for(int i=0;i<(int)listOfGlyphs.size();i++)
+      if(listOfGlyphs[i].width) count[listOfGlyphs[i].flags&PFX_GLYPH_ENCODING_MASK]++;
+    fprintf(output,"// Glyph encodings : raw %d, rle %d, heatshrink %d, dictionary %d\n",count[0],count[1],count[2],count[3]);
+  }
+  if(kerning)
+  {
+    fprintf(output,"// Kerning : %d pairs, %d bytes\n",(int)kerningPairs.size(),(int)kerningPairs.size()*5);
+  }
+  int nbDrawn=_drawStats.glyphs;
+  if(nbDrawn)
+  {
+    fprintf(output,"// Decoding estimate : %d cycles per glyph average, %d max (Cortex-M0)\n",(int)(_totalDecodeCycles/nbDrawn),_maxDecodeCycles);
+    fprintf(output,"// Drawing estimate  : %d cycles per glyph average, %d max, decoding included\n",(int)(_totalDrawCycles/nbDrawn),_maxDrawCycles);
+    fprintf(output,"// Per glyph average : %d bytes read, %d back references, %d pixels written\n",
+            (int)_drawStats.bytesRead/nbDrawn,(int)_drawStats.backRefs/nbDrawn,(int)_drawStats.pixelsWritten/nbDrawn);
+  }
 
-  sz=(last-first+1)*sizeof(PFXglyph);
+  // arrays shared with an earlier font of the same file are not counted
+  sz=isShared("Glyphs") ? 0 : nbGlyphEntries()*sizeof(PFXglyph);
+  sz+=ranges.size()*sizeof(PFXrange);
+  sz+=offsetBases.size()*sizeof(uint32_t);
+  sz+=kerningPairs.size()*(sizeof(uint32_t)+sizeof(int8_t));
   fprintf(output,"// Header : about %d bytes (%d kBytes)\n",sz,(sz+1023)/1024);
-  sz+=bitPusher.offset()+sizeof(PFXfont);
+  sz+=sizeof(PFXfont);
+  if(!isShared("Bitmaps")) sz+=bitmapSize();
+  if(!isShared("Dictionary")) sz+=dictionary.size();
   fprintf(output,"//--------------------------------------\n");
   fprintf(output,"// total : about %d bytes (%d kBytes)\n",sz,(sz+1023)/1024);
 }
 
 
+/**
+ * Call fn(worker,0..nb-1) from up to nbThreads threads, worker being 0..nbThreads-1
+ * @return false if any call failed
+ */
+bool FontConverter::runParallel(int nb, int nbThreads, const std::function<bool(int,int)> &fn, int minPerThread)
+{
+    int workers=nbThreads;
+    if(workers>nb/minPerThread) workers=nb/minPerThread;
+    if(workers<1) workers=1;
+    std::atomic<int>  next(0);
+    std::atomic<bool> failed(false);
+    auto worker=[&](int id)
+    {
+        while(!failed)
+        {
+            int i=next++;
+            if(i>=nb) break;
+            if(!fn(id,i)) failed=true;
+        }
+    };
+    std::vector<std::thread> pool;
+    for(int i=1;i<workers;i++)
+        pool.push_back(std::thread(worker,i));
+    worker(0);
+    for(int i=0;i<(int)pool.size();i++)
+        pool[i].join();
+    return !failed;
+}
+/**
+ * Render all the glyphs, possibly on several threads, then put them
+ * in order in the bitmap. Each glyph is rendered, packed and compressed
+ * on its own, so the result does not depend on the number of threads
+ * @return
+ */
 bool  FontConverter::convert()
 {
-    switch(bpp)
+    if(!face) return false;
+    if(bpp!=1 && bpp!=2 && bpp!=4 && bpp!=8)
     {
-        case 1: return convert1bit();break;
-        case 4:
-        case 8:
-        case 2: return convertNbit(bpp);break;
-        default:
-            printf("Unsupported bpp, only 1 or 4");
-            break;
+        printf("Unsupported bpp, only 1,2,4 or 8\n");
+        return false;
     }
-    return false;
+    if(format && formatSourceBpp(format)!=bpp)
+    {
+        printf("Display format %s is rendered at %d bpp\n",formatName(format),formatSourceBpp(format));
+        return false;
+    }
+    if(streaming)
+        return convertStreaming();
+    const std::vector<uint32_t> &codes=codePoints;
+    int nb=codes.size();
+    std::vector<EncodedGlyph> encoded(nb);
+
+    // Only render what the cache does not already have
+    GlyphCache cache;
+    std::vector<int> todo;
+    // same load target as convert1bit / convertNbit
+    int loadTarget= bpp==1 ? FT_LOAD_TARGET_MONO : FT_LOAD_TARGET_NORMAL;
+    if(cacheDir.size() && !cache.open(cacheDir,fontFile,face->glyph->library,fontSize,bpp,loadTarget,rotation))
+        return false;
+    for(int i=0;i<nb;i++)
+        if(!cacheDir.size() || !cache.lookup(codes[i],encoded[i]))
+            todo.push_back(i);
+    int nbTodo=todo.size();
+
+    // worker 0 uses our own face, the others their own copy from the pool, FreeType faces are not thread safe
+    // runParallel does not bother spawning threads (and loading the face again) for a handful of glyphs
+    faces->reserve(nbThreads);
+    double initBefore=faces->initMs();
+    std::vector<FT_Face> workerFaces(nbThreads,(FT_Face)NULL);
+    std::vector<std::unique_ptr<BitPusher> > scratch(nbThreads);
+    std::vector<double> loadMs(nbThreads,0);
+    bool ok=runParallel(nbTodo,nbThreads,[&](int worker, int t)
+    {
+        if(!workerFaces[worker])
+        {
+            auto start=std::chrono::steady_clock::now();
+            workerFaces[worker]=faces->activate(worker,fontSize);
+            if(worker) loadMs[worker]=fcElapsedMs(start);
+            if(!workerFaces[worker]) return false;
+            scratch[worker].reset(new BitPusher);
+        }
+        int i=todo[t];
+        return convertGlyph(workerFaces[worker],codes[i],*scratch[worker],encoded[i]);
+    });
+    if(!ok)
+        return false;
+    if(cacheDir.size())
+    {
+        for(int t=0;t<nbTodo;t++)
+            cache.store(codes[todo[t]],encoded[todo[t]]);
+        cache.save(); // not fatal, we will render again next time
+        printf("Glyph cache : %d reused, %d rendered\n",cache.hits,cache.misses);
+    }
+    // the cache keeps what FreeType gave, trimming & the display layout are derived from it
+    if(trim)
+    {
+        for(int i=0;i<nb;i++)
+            if(encoded[i].rendered)
+                trimGlyph(encoded[i]);
+    }
+    if(format)
+    {
+        for(int i=0;i<nb;i++)
+            if(encoded[i].rendered)
+                toDisplayFormat(encoded[i]);
+    }
+    // atlas : the pixels go to the pages, the glyphs only keep their metrics
+    if(atlasWidth)
+    {
+        if(!buildAtlas(encoded))
+            return false;
+        for(int i=0;i<nb;i++)
+            encoded[i].data.clear();
+    }
+
+    // Compression is a second pass, the dictionary and the parameter search need all the glyphs
+    for(int i=1;i<nbThreads;i++)
+        stats.loadMs+=loadMs[i];
+    stats.initMs+=faces->initMs()-initBefore;
+    stats.nbGlyphs=nb;
+    for(int i=0;i<nbTodo;i++)
+    {
+        const EncodedGlyph &e=encoded[todo[i]];
+        stats.glyphLoadMs+=e.loadMs;
+        stats.renderMs+=e.renderMs;
+        stats.packMs+=e.packMs;
+        stats.renderBytes+=e.renderedBytes;
+    }
+    auto compressStart=std::chrono::steady_clock::now();
+    if(compressed)
+    {
+        if(hsSearch && !searchParameters(encoded))
+            return false;
+        if(!compressGlyphs(encoded))
+            return false;
+    }
+    stats.compressMs=fcElapsedMs(compressStart);
+
+    // Ordered assembly, glyphs that failed to render are left empty
+    // With dedup, glyphs whose stored bytes are identical share them. The bytes
+    // are all a glyph decoder reads, so this is safe whatever the encoding & size
+    PFXglyph zeroGlyph= (PFXglyph){0,0,0,0,0,0,0};
+    std::unordered_map<std::string,int> stored;
+    std::vector<bool> fromCache;
+    if(glyphStats)
+    {
+        fromCache.assign(nb,true);
+        for(int t=0;t<nbTodo;t++) fromCache[todo[t]]=false;
+        stats.glyphs.clear();
+    }
+    for(int i=0;i<nb;i++)
+    {
+        EncodedGlyph &e=encoded[i];
+        if(!e.rendered)
+        {
+            bitmapOffsets.push_back(0);
+            listOfGlyphs.push_back(zeroGlyph);
+            continue;
+        }
+        if(glyphStats)
+            stats.glyphs.push_back(describeGlyph(codes[i],e,fromCache[i]));
+        _totalUncompressedSize+=e.rawSize;
+        bitPusher.align();
+        std::vector<uint8_t> bytes;
+        if(e.gapLength)
+        {
+            // the row gap header goes before the data, whatever its encoding
+            bytes.push_back(e.gapStart);
+            bytes.push_back(e.gapLength);
+        }
+        bytes.insert(bytes.end(),e.data.begin(),e.data.end());
+        if(dedup && bytes.size())
+        {
+            std::string key((const char *)bytes.data(),bytes.size());
+            auto it=stored.find(key);
+            if(it!=stored.end())
+            {
+                bitmapOffsets.push_back(it->second);
+                listOfGlyphs.push_back(e.glyph);
+                if(glyphStats) stats.glyphs.back().shared=true;
+                _dedupGlyphs++;
+                _dedupBytes+=bytes.size();
+                continue;
+            }
+            stored[key]=bitPusher.offset();
+        }
+        bitmapOffsets.push_back(bitPusher.offset());
+        listOfGlyphs.push_back(e.glyph);
+        bitPusher.addBytes(bytes.size(),bytes.data());
+    }
+    face_height= face->size->metrics.height >> 6;
+    stats.packBytes=_totalUncompressedSize;
+    stats.compressBytes=bitmapSize();
+    if(!layoutOffsets())
+        return false;
+    if(kerning && !extractKerning())
+        return false;
+    if(!verifyGlyphs(encoded))
+        return false;
+    stats.peakKb=fcPeakMemoryKb();
+    return true;
+}
+/**
+ * Glyph offsets are 16 bits. When the bitmap is bigger than that, glyphs are
+ * grouped in blocks of 2^offsetBlockShift, each block having a 32 bits base
+ * the glyph offsets are relative to. Take the biggest blocks that fit.
+ * @return
+ */
+bool FontConverter::layoutOffsets()
+{
+    int nb=listOfGlyphs.size();
+    offsetBases.clear();
+    offsetBlockShift=0;
+    uint32_t maxOffset=0;
+    for(int i=0;i<nb;i++)
+        if(bitmapOffsets[i]>maxOffset) maxOffset=bitmapOffsets[i];
+    if(maxOffset<=0xFFFF)
+    {
+        for(int i=0;i<nb;i++)
+            listOfGlyphs[i].bitmapOffset=bitmapOffsets[i];
+        return true;
+    }
+    int entries=nbGlyphEntries();
+    for(int shift=FC_MAX_BLOCK_SHIFT;shift>=0;shift--)
+    {
+        int nbBlocks=(entries+(1<<shift)-1)>>shift;
+        std::vector<uint32_t> low(nbBlocks,0xFFFFFFFF),high(nbBlocks,0);
+        for(int i=0;i<nb;i++)
+        {
+            // empty glyphs are never read, their offset does not matter
+            if(!listOfGlyphs[i].width || !listOfGlyphs[i].height) continue;
+            int b=glyphIndex(i)>>shift;
+            if(bitmapOffsets[i]<low[b]) low[b]=bitmapOffsets[i];
+            if(bitmapOffsets[i]>high[b]) high[b]=bitmapOffsets[i];
+        }
+        bool fit=true;
+        for(int b=0;b<nbBlocks && fit;b++)
+        {
+            if(low[b]==0xFFFFFFFF) low[b]=0;
+            else if(high[b]-low[b]>0xFFFF) fit=false;
+        }
+        if(!fit) continue;
+        offsetBases=low;
+        offsetBlockShift=shift;
+        for(int i=0;i<nb;i++)
+        {
+            if(!listOfGlyphs[i].width || !listOfGlyphs[i].height)
+                listOfGlyphs[i].bitmapOffset=0;
+            else
+                listOfGlyphs[i].bitmapOffset=bitmapOffsets[i]-low[glyphIndex(i)>>shift];
+        }
+        printf("Large font : %d offset bases, %d glyphs per block\n",nbBlocks,1<<shift);
+        return true;
+    }
+    return false; // cannot happen, one glyph per block always fits
+}
+/**
+ * PFXglyph fields are 8 bits, refuse what would silently wrap
+ * @return
+ */
+bool FontConverter::metricsFit(int code, int width, int height, int advance, int left, int top)
+{
+    if(width>255 || height>255 || advance>255 || advance<0 || left<-128 || left>127 || top<-128 || top>127)
+    {
+        fprintf(stderr, "Glyph '%s' too large for the font format (%dx%d), use a smaller size\n",printable(code).c_str(),width,height);
+        return false;
+    }
+    return true;
+}
+/**
+ * Copy what the scratch pusher holds into the encoded glyph
+ * @param pusher
+ * @param out
+ * @return
+ */
+bool FontConverter::finishGlyph(BitPusher &pusher, EncodedGlyph &out)
+{
+    pusher.align();
+    int size=pusher.offset();
+    out.rawSize=size;
+    out.raw.assign(pusher.data(),pusher.data()+size);
+    out.rendered=true;
+    out.data=out.raw; // replaced when compressing
+    return true;
+}
+/**
+ *
+ * @param face
+ * @param code
+ * @param pusher
+ * @param out
+ * @return
+ */
+bool FontConverter::convertGlyph(FT_Face face, int code, BitPusher &pusher, EncodedGlyph &out)
+{
+    pusher.setOffset(0);
+    if(bpp==1)
+        return convert1bit(face,code,pusher,out);
+    return convertNbit(face,code,bpp,pusher,out);
 }
  /**
   *
   * @return
   */
- bool FontConverter::convertNbit(int n)
+ bool FontConverter::convertNbit(FT_Face face, int i, int n, BitPusher &bitPusher, EncodedGlyph &out)
  {
      int err;
-     FT_Glyph glyph;
-     PFXglyph zeroGlyph= (PFXglyph){0,0,0,0,0,0};     
-     if(!face) return false;
-     for(int i=first;i<= last;i++)
-     {
-        if(!_mapp[i])
-        {
-            listOfGlyphs.push_back(zeroGlyph);
-            continue;
-        } 
         // MONO renderer provides clean image with perfect crop
         // (no wasted pixels) via bitmap struct.
-        bool renderingOk=true;
-        if ((err = FT_Load_Char(face, i, FT_LOAD_TARGET_NORMAL))) {     fprintf(stderr, "Error %d loading char '%c'\n", err, i); renderingOk=false;   }
-        if (renderingOk && (err = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL))) {      fprintf(stderr, "Error %d rendering char '%c'\n", err, i);     renderingOk=false;  }
-        if (renderingOk && (err = FT_Get_Glyph(face->glyph, &glyph))) {      fprintf(stderr, "Error %d getting glyph '%c'\n", err, i);    renderingOk=false;    }
-
-        if(!renderingOk)
+        auto start=std::chrono::steady_clock::now();
+        if ((err = FT_Load_Char(face, i, FT_LOAD_TARGET_NORMAL))) {     fprintf(stderr, "Error %d loading char '%s'\n", err, printable(i).c_str()); return true;   }
+        out.loadMs=fcElapsedMs(start);
+        start=std::chrono::steady_clock::now();
+        if ((err = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL))) {      fprintf(stderr, "Error %d rendering char '%s'\n", err, printable(i).c_str());     return true;  }
+        // the slot bitmap is used in place, no FT_Glyph copy to allocate & free for each glyph
+        FT_Bitmap *bitmap = &face->glyph->bitmap;
+        int xOffset=face->glyph->bitmap_left,yOffset=1 - face->glyph->bitmap_top;
+        FT_Bitmap rotated;
+        std::vector<uint8_t> rotatedPixels;
+        if(rotation)
         {
-            listOfGlyphs.push_back(zeroGlyph);
-            continue;
+            rotateMetrics(rotation,bitmap->width,bitmap->rows,xOffset,yOffset);
+            rotateBitmap(*bitmap,rotation,rotatedPixels,rotated);
+            bitmap=&rotated;
         }
-        FT_Bitmap *bitmap = &face->glyph->bitmap;
-        FT_BitmapGlyphRec *g= (FT_BitmapGlyphRec *)glyph;
 
         // Minimal font and per-glyph information is stored to
         // reduce flash space requirements.  Glyph bitmaps are
         // fully bit-packed; no per-scanline pad, though end of
         // each character may be padded to next byte boundary
-        // when needed.  16-bit offset means 64K max for bitmaps,
-        // code currently doesn't check for overflow.  (Doesn't
-        // check that size & offsets are within bounds either for
-        // that matter...please convert fonts responsibly.)
-        bitPusher.align();
-        int startOffset=bitPusher.offset();
-        PFXglyph thisGlyph;
-        thisGlyph.bitmapOffset = bitPusher.offset();
+        // when needed.  metricsFit() rejects metrics that do not
+        // fit the PFXglyph fields.  The 16-bit bitmapOffset is
+        // set by layoutOffsets() once all glyphs are known : past
+        // 64K it is relative to the 32-bit base of its block of
+        // glyphs (PFXfont::offsetBase).
+        if(!metricsFit(i,bitmap->width,bitmap->rows,face->glyph->advance.x >> 6,xOffset,yOffset))
+            return false;
+        PFXglyph &thisGlyph=out.glyph;
+        thisGlyph.bitmapOffset = 0; // set when assembling
         thisGlyph.width = bitmap->width;
         thisGlyph.height = bitmap->rows;
         thisGlyph.xAdvance = face->glyph->advance.x >> 6;
-        thisGlyph.xOffset = g->left;
-        thisGlyph.yOffset = 1 - g->top;
-        listOfGlyphs.push_back(thisGlyph);
+        thisGlyph.xOffset = xOffset;
+        thisGlyph.yOffset = yOffset;
 
-        for (int y = 0; y < bitmap->rows; y++)
+        if(n!=2 && n!=4 && n!=8)
         {
-          const uint8_t *line=bitmap->buffer+y * bitmap->pitch;
-          for (int x = 0; x < bitmap->width; x++)
-          {
-            switch(n)
-            {
-                case 4: bitPusher.add4Bits(line[x]>>4);break;
-                case 2: 
-                {
-                    const uint8_t p2[4]={' ','-','+','*'};
-                        int pix=(line[x]+31)>>6;
-                        if(pix>3) pix=3;
-                        //printf("%c",p2[pix]);
-                        bitPusher.add2Bits(pix);
-                }
-                        break;
-                case 8: bitPusher.add8Bits(line[x]);break;
-                default:
-                    printf("Unsupported bpp\n");
-                    exit(-1);
-                    break;
-            }
-          }
-         // printf("\n");
-        }
-        bitPusher.align();
-        int size=bitPusher.offset()-startOffset;
-        _totalUncompressedSize+=size;
-        if(compressed)
-        {            
-            compressInPlace((uint8_t *)(bitPusher.data()+startOffset),size);
-            bitPusher.setOffset(startOffset+size);
+            printf("Unsupported bpp\n");
+            return false;
         }
-    }
-    face_height= face->size->metrics.height >> 6;
-    FT_Done_Glyph(glyph);
-    return true;
+        out.renderMs=fcElapsedMs(start);
+        out.renderedBytes=bitmap->rows*abs(bitmap->pitch);
+        start=std::chrono::steady_clock::now();
+        // whole rows at once, see flatconvert_pack.cpp
+        for (int y = 0; y < bitmap->rows; y++)
+          bitPusher.addRow(bitmap->buffer+y * bitmap->pitch,bitmap->width,n);
+        out.packMs=fcElapsedMs(start);
+        return finishGlyph(bitPusher,out);
  }
 
 
@@ -344,78 +1222,55 @@ bool  FontConverter::convert()
   *
   * @return
   */
- bool FontConverter::convert1bit()
+ bool FontConverter::convert1bit(FT_Face face, int i, BitPusher &bitPusher, EncodedGlyph &out)
  {
      int err;
-     FT_Glyph glyph;
-     if(!face) return false;
-     PFXglyph zeroGlyph= (PFXglyph){0,0,0,0,0,0};
-     for(int i=first;i<= last;i++)
-     {
-        if(!_mapp[i])
-        {
-            listOfGlyphs.push_back(zeroGlyph);
-            continue;
-        } 
 
         // MONO renderer provides clean image with perfect crop
         // (no wasted pixels) via bitmap struct.
-        bool renderingOk=true;
-        if ((err = FT_Load_Char(face, i, FT_LOAD_TARGET_MONO))) {     fprintf(stderr, "Error %d loading char '%c'\n", err, i); renderingOk=false;   }
-        if ((err = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_MONO))) {      fprintf(stderr, "Error %d rendering char '%c'\n", err, i);     renderingOk=false;  }
-        if ((err = FT_Get_Glyph(face->glyph, &glyph))) {      fprintf(stderr, "Error %d getting glyph '%c'\n", err, i);    renderingOk=false;    }
-
-        if(!renderingOk)
+        auto start=std::chrono::steady_clock::now();
+        if ((err = FT_Load_Char(face, i, FT_LOAD_TARGET_MONO))) {     fprintf(stderr, "Error %d loading char '%s'\n", err, printable(i).c_str()); return true;   }
+        out.loadMs=fcElapsedMs(start);
+        start=std::chrono::steady_clock::now();
+        if ((err = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_MONO))) {      fprintf(stderr, "Error %d rendering char '%s'\n", err, printable(i).c_str());     return true;  }
+        FT_Bitmap *bitmap = &face->glyph->bitmap;
+        int xOffset=face->glyph->bitmap_left,yOffset=1 - face->glyph->bitmap_top;
+        FT_Bitmap rotated;
+        std::vector<uint8_t> rotatedPixels;
+        if(rotation)
         {
-            listOfGlyphs.push_back(zeroGlyph);
-            continue;
+            rotateMetrics(rotation,bitmap->width,bitmap->rows,xOffset,yOffset);
+            rotateBitmap(*bitmap,rotation,rotatedPixels,rotated);
+            bitmap=&rotated;
         }
-        FT_Bitmap *bitmap = &face->glyph->bitmap;
-        FT_BitmapGlyphRec *g= (FT_BitmapGlyphRec *)glyph;
 
         // Minimal font and per-glyph information is stored to
         // reduce flash space requirements.  Glyph bitmaps are
         // fully bit-packed; no per-scanline pad, though end of
         // each character may be padded to next byte boundary
-        // when needed.  16-bit offset means 64K max for bitmaps,
-        // code currently doesn't check for overflow.  (Doesn't
-        // check that size & offsets are within bounds either for
-        // that matter...please convert fonts responsibly.)
-        bitPusher.align();
-        int startOffset=bitPusher.offset();
-        
-        
-        PFXglyph thisGlyph;
-        thisGlyph.bitmapOffset = bitPusher.offset();
+        // when needed.  metricsFit() rejects metrics that do not
+        // fit the PFXglyph fields.  The 16-bit bitmapOffset is
+        // set by layoutOffsets() once all glyphs are known : past
+        // 64K it is relative to the 32-bit base of its block of
+        // glyphs (PFXfont::offsetBase).
+        if(!metricsFit(i,bitmap->width,bitmap->rows,face->glyph->advance.x >> 6,xOffset,yOffset))
+            return false;
+        PFXglyph &thisGlyph=out.glyph;
+        thisGlyph.bitmapOffset = 0; // set when assembling
         thisGlyph.width = bitmap->width;
         thisGlyph.height = bitmap->rows;
         thisGlyph.xAdvance = face->glyph->advance.x >> 6;
-        thisGlyph.xOffset = g->left;
-        thisGlyph.yOffset = 1 - g->top;
-        listOfGlyphs.push_back(thisGlyph);
+        thisGlyph.xOffset = xOffset;
+        thisGlyph.yOffset = yOffset;
 
+        out.renderMs=fcElapsedMs(start);
+        out.renderedBytes=bitmap->rows*abs(bitmap->pitch);
+        start=std::chrono::steady_clock::now();
+        // mono rows are already packed, they only need shifting in
         for (int y = 0; y < bitmap->rows; y++)
-        {
-          const uint8_t *line=bitmap->buffer+y * bitmap->pitch;
-          for (int x = 0; x < bitmap->width; x++)
-          {
-            int byte = x / 8;
-            int bit = 0x80 >> (x & 7);
-            bitPusher.addBit(line[byte] & bit);
-          }
-        }
-        bitPusher.align();
-        int size=bitPusher.offset()-startOffset;
-        _totalUncompressedSize+=size;
-        if(compressed)
-        {
-            compressInPlace((uint8_t *)(bitPusher.data()+startOffset),size);
-            bitPusher.setOffset(startOffset+size);
-        }
-    }
-    face_height= face->size->metrics.height >> 6;
-    FT_Done_Glyph(glyph);
-    return true;
+          bitPusher.addPacked(bitmap->buffer+y * bitmap->pitch,bitmap->width);
+        out.packMs=fcElapsedMs(start);
+        return finishGlyph(bitPusher,out);
  }
 
 // EOF
@@ -0,0 +1,215 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "flatconvert.h"
+
+/**
+ * Display native formats, see PFX_FORMAT_xxx in pfxfont.h
+ * Glyphs are rendered as usual (grey levels or mono), cached that way, and
+ * only turned into what the display takes right before compression
+ */
+static const struct
+{
+    const char *name;
+    int         format;
+    const char *tag;
+} formats[]=
+{
+    {"gray",    0,                 "0"},
+    {"ssd1306", PFX_FORMAT_PAGE,   "PFX_FORMAT_PAGE"},
+    {"page",    PFX_FORMAT_PAGE,   "PFX_FORMAT_PAGE"},
+    {"rgb332",  PFX_FORMAT_RGB332, "PFX_FORMAT_RGB332"},
+    {"rgb565",  PFX_FORMAT_RGB565, "PFX_FORMAT_RGB565"},
+};
+#define NB_FORMATS (int)(sizeof(formats)/sizeof(formats[0]))
+
+/**
+ * @param name gray, ssd1306 (or page), rgb332, rgb565
+ * @param format
+ * @return false if unknown
+ */
+bool parseFormat(const std::string &name, int &format)
+{
+    for(int i=0;i<NB_FORMATS;i++)
+        if(name==formats[i].name)
+        {
+            format=formats[i].format;
+            return true;
+        }
+    return false;
+}
+/**
+ * 0xRRGGBB or #RRGGBB
+ * @param value
+ * @param color
+ * @return
+ */
+bool parseColor(const std::string &value, uint32_t &color)
+{
+    const char *s=value.c_str();
+    if(*s=='#') s++;
+    else if(s[0]=='0' && (s[1]=='x' || s[1]=='X')) s+=2;
+    char *end;
+    unsigned long c=strtoul(s,&end,16);
+    if(!*s || *end || c>0xFFFFFF)
+        return false;
+    color=c;
+    return true;
+}
+/**
+ * What is printed in PFXfont::bpp
+ */
+const char *FontConverter::formatName(int format)
+{
+    for(int i=0;i<NB_FORMATS;i++)
+        if(formats[i].format==format)
+            return formats[i].tag;
+    return "0";
+}
+/**
+ * What FreeType renders for a format
+ * @return 1 or 8, 0 for grey levels (use the bpp asked)
+ */
+int FontConverter::formatSourceBpp(int format)
+{
+    switch(format)
+    {
+        case PFX_FORMAT_PAGE:   return 1;
+        case PFX_FORMAT_RGB332:
+        case PFX_FORMAT_RGB565: return 8;
+        default:                return 0;
+    }
+}
+/**
+ * fg over bg, alpha 0..255, one 8 bits channel at a time
+ */
+static uint32_t blend(uint32_t fg, uint32_t bg, int alpha)
+{
+    uint32_t out=0;
+    for(int shift=0;shift<24;shift+=8)
+    {
+        int f=(fg>>shift)&0xFF;
+        int b=(bg>>shift)&0xFF;
+        out|=(uint32_t)((f*alpha+b*(255-alpha)+127)/255)<<shift;
+    }
+    return out;
+}
+/**
+ * Turn the rendered glyph (1 bpp for pages, 8 bpp for RGB) into the display layout
+ * @param e
+ */
+void FontConverter::toDisplayFormat(EncodedGlyph &e)
+{
+    int w=e.glyph.width,h=e.glyph.height;
+    std::vector<uint8_t> out(pfxGlyphSize(&e.glyph,format),0);
+    switch(format)
+    {
+        case PFX_FORMAT_PAGE:
+            for(int y=0;y<h;y++)
+                for(int x=0;x<w;x++)
+                    if(pfxPackedPixel(e.raw.data(),y*w+x,1))
+                        out[(y>>3)*w+x]|=1<<(y&7);
+            break;
+        case PFX_FORMAT_RGB332:
+        case PFX_FORMAT_RGB565:
+            for(int i=0;i<w*h;i++)
+            {
+                uint32_t c=blend(fgColor,bgColor,e.raw[i]);
+                int r=(c>>16)&0xFF,g=(c>>8)&0xFF,b=c&0xFF;
+                if(format==PFX_FORMAT_RGB332)
+                {
+                    out[i]=(r&0xE0)|((g&0xE0)>>3)|(b>>6);
+                }else
+                {
+                    int v=((r&0xF8)<<8)|((g&0xFC)<<3)|(b>>3);
+                    out[2*i]=v>>8;
+                    out[2*i+1]=v&0xFF;
+                }
+            }
+            break;
+        default:
+            return;
+    }
+    e.raw=out;
+    e.rawSize=out.size();
+    e.data=e.raw;
+}
+
+/**
+ * Rotated fonts, see PFX_ROTATE_xxx : the FreeType bitmap is turned before
+ * being packed so that the device can stream the glyph in the panel scan order
+ * Pixel x,y of a w x h bitmap goes to :
+ *    90 : h-1-y, x
+ *   180 : w-1-x, h-1-y
+ *   270 : y, w-1-x
+ * @param in mono or grey FreeType bitmap
+ * @param rotation quarter turns clockwise
+ * @param buffer holds the rotated pixels
+ * @param out same pixel mode as in
+ */
+void FontConverter::rotateBitmap(const FT_Bitmap &in, int rotation, std::vector<uint8_t> &buffer, FT_Bitmap &out)
+{
+    bool mono=(in.pixel_mode==FT_PIXEL_MODE_MONO);
+    int w=in.width,h=in.rows;
+    out=in;
+    if(rotation&1)
+    {
+        out.width=h;
+        out.rows=w;
+    }
+    out.pitch=mono ? (out.width+7)/8 : out.width;
+    buffer.assign(out.pitch*out.rows+1,0);
+    out.buffer=buffer.data();
+    for(int y=0;y<h;y++)
+    {
+        const uint8_t *row=in.buffer+y*in.pitch;
+        for(int x=0;x<w;x++)
+        {
+            int v= mono ? (row[x>>3]>>(7-(x&7)))&1 : row[x];
+            if(!v) continue;
+            int nx,ny;
+            switch(rotation)
+            {
+                case PFX_ROTATE_90:  nx=h-1-y; ny=x;     break;
+                case PFX_ROTATE_180: nx=w-1-x; ny=h-1-y; break;
+                case PFX_ROTATE_270: nx=y;     ny=w-1-x; break;
+                default:             nx=x;     ny=y;     break;
+            }
+            if(mono)
+                buffer[ny*out.pitch+(nx>>3)]|=0x80>>(nx&7);
+            else
+                buffer[ny*out.pitch+nx]=v;
+        }
+    }
+}
+/**
+ * Offsets from the cursor to the top left pixel, in panel coordinates
+ * The text runs along the rotated x axis, so xAdvance keeps its value
+ * @param width,height of the upright bitmap
+ */
+void FontConverter::rotateMetrics(int rotation, int width, int height, int &xOffset, int &yOffset)
+{
+    int xo=xOffset,yo=yOffset;
+    switch(rotation)
+    {
+        case PFX_ROTATE_90:  xOffset=-yo-height; yOffset=xo;        break;
+        case PFX_ROTATE_180: xOffset=-xo-width;  yOffset=-yo-height; break;
+        case PFX_ROTATE_270: xOffset=yo;         yOffset=-xo-width;  break;
+        default: break;
+    }
+}
@@ -0,0 +1,90 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "flatconvert.h"
+
+/**
+ * Pull the pair adjustments of the picked glyphs from the font, rounded to
+ * whole pixels. Only the pairs that move something are kept, sorted on
+ * left glyph index << 16 | right glyph index so that pfxKerning() can
+ * binary search them.
+ * FreeType only reads the TrueType 'kern' table there, GPOS pair
+ * adjustments are not seen. Every pair has to be asked for, fonts with
+ * more than FC_KERNING_MAX_GLYPHS glyphs are left without kerning
+ * @return false if FreeType fails
+ */
+bool FontConverter::extractKerning()
+{
+    kerningPairs.clear();
+    kerningValues.clear();
+    FT_Face kernFace=faces->activate(0,fontSize);
+    if(!kernFace) return false;
+    if(!FT_HAS_KERNING(kernFace))
+    {
+        printf("Warning : %s has no kerning table\n",fontFile.c_str());
+        return true;
+    }
+    int nb=codePoints.size();
+    if(nb>FC_KERNING_MAX_GLYPHS || nbGlyphEntries()>0xFFFF)
+    {
+        printf("Warning : too many glyphs (%d) for kerning, max %d\n",nb,FC_KERNING_MAX_GLYPHS);
+        return true;
+    }
+    std::vector<FT_UInt> index(nb);
+    for(int i=0;i<nb;i++)
+        index[i]=FT_Get_Char_Index(kernFace,codePoints[i]);
+
+    // codePoints is sorted and glyphIndex() grows with it, the pairs come out sorted
+    for(int l=0;l<nb;l++)
+    {
+        if(!index[l]) continue;
+        for(int r=0;r<nb;r++)
+        {
+            if(!index[r]) continue;
+            FT_Vector delta;
+            if(FT_Get_Kerning(kernFace,index[l],index[r],FT_KERNING_DEFAULT,&delta))
+            {
+                printf("Error : FT_Get_Kerning failed\n");
+                return false;
+            }
+            int value=delta.x>>6;
+            if(!value) continue;
+            if(value<-128) value=-128;
+            if(value>127) value=127;
+            kerningPairs.push_back(((uint32_t)glyphIndex(l)<<16) | (uint32_t)glyphIndex(r));
+            kerningValues.push_back((int8_t)value);
+        }
+    }
+    return true;
+}
+
+/**
+ * xxxKerning & xxxKerningValues, the pairs and their adjustment
+ */
+void FontConverter::printKerning()
+{
+    if(!kerningPairs.size()) return;
+    fprintf(output,"const uint32_t %sKerning[] PROGMEM = {\n", symbolName.c_str());
+    for(int i=0;i<(int)kerningPairs.size();i++)
+        fprintf(output,"  0x%08X,%s",kerningPairs[i],(i%6)==5 ? "\n" : "");
+    fprintf(output,"\n};\n");
+    fprintf(output,"const int8_t %sKerningValues[] PROGMEM = {\n", symbolName.c_str());
+    for(int i=0;i<(int)kerningValues.size();i++)
+        fprintf(output," %4d,%s",kerningValues[i],(i%12)==11 ? "\n" : "");
+    fprintf(output,"\n};\n");
+}
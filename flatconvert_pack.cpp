@@ -0,0 +1,250 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "flatconvert.h"
+#include "stdlib.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// All kernels give the same output as BitPusher::add2Bits/add4Bits called per pixel
+//   4 bpp : top nibble
+//   2 bpp : (gray+31)>>6, clamped to 3
+
+/**
+ * 2 bpp quantization of one pixel
+ */
+static inline int quant2(int gray)
+{
+    int pix=(gray+31)>>6;
+    return pix>3 ? 3 : pix;
+}
+/**
+ * Odd pixel counts : the last, partial, byte
+ */
+static void packTail2(const uint8_t *in, int width, int x, uint8_t *out)
+{
+    if(x>=width) return;
+    int v=0;
+    int shift=6;
+    for(;x<width;x++,shift-=2)
+        v|=quant2(in[x])<<shift;
+    *out=v;
+}
+static void packTail4(const uint8_t *in, int width, int x, uint8_t *out)
+{
+    if(x>=width) return;
+    *out=in[x]&0xF0; // at most one pixel left
+}
+
+//-- Scalar, 8 pixels per 64 bits word when possible
+
+static void scalarPack2(const uint8_t *in, int width, uint8_t *out)
+{
+    int x=0;
+    for(;x+4<=width;x+=4)
+        *out++=(quant2(in[x])<<6)|(quant2(in[x+1])<<4)|(quant2(in[x+2])<<2)|quant2(in[x+3]);
+    packTail2(in,width,x,out);
+}
+static void scalarPack4(const uint8_t *in, int width, uint8_t *out)
+{
+    int x=0;
+    for(;x+8<=width;x+=8)
+    {
+        uint64_t v;
+        memcpy(&v,in+x,8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        // each 16 bits lane : first pixel in the low byte
+        uint64_t t=(v&0x00F000F000F000F0ULL)|((v>>12)&0x000F000F000F000FULL);
+        out[0]=t;
+        out[1]=t>>16;
+        out[2]=t>>32;
+        out[3]=t>>48;
+#else
+        uint64_t t=((v>>8)&0x00F000F000F000F0ULL)|((v>>4)&0x000F000F000F000FULL);
+        out[0]=t>>48;
+        out[1]=t>>32;
+        out[2]=t>>16;
+        out[3]=t;
+#endif
+        out+=4;
+    }
+    for(;x+2<=width;x+=2)
+        *out++=(in[x]&0xF0)|(in[x+1]>>4);
+    packTail4(in,width,x,out);
+}
+
+#if defined(__SSE2__)
+//-- SSE2, 64 pixels per loop at 2 bpp, 32 at 4 bpp
+
+static inline __m128i sse2Quads(const uint8_t *in)
+{
+    const __m128i three=_mm_set1_epi8(3);
+    const __m128i low8=_mm_set1_epi16(0xFF);
+    const __m128i low16=_mm_set1_epi32(0xFFFF);
+    __m128i v=_mm_loadu_si128((const __m128i *)in);
+    // saturating add : 225..255 give 3 as the clamp does
+    __m128i q=_mm_and_si128(_mm_srli_epi16(_mm_adds_epu8(v,_mm_set1_epi8(31)),6),three);
+    __m128i pairs=_mm_or_si128(_mm_slli_epi16(_mm_and_si128(q,low8),2),_mm_srli_epi16(q,8));
+    return _mm_or_si128(_mm_slli_epi32(_mm_and_si128(pairs,low16),4),_mm_srli_epi32(pairs,16));
+}
+static void sse2Pack2(const uint8_t *in, int width, uint8_t *out)
+{
+    int x=0;
+    for(;x+64<=width;x+=64)
+    {
+        __m128i a=_mm_packs_epi32(sse2Quads(in+x),sse2Quads(in+x+16));
+        __m128i b=_mm_packs_epi32(sse2Quads(in+x+32),sse2Quads(in+x+48));
+        _mm_storeu_si128((__m128i *)out,_mm_packus_epi16(a,b));
+        out+=16;
+    }
+    for(;x+4<=width;x+=4)
+        *out++=(quant2(in[x])<<6)|(quant2(in[x+1])<<4)|(quant2(in[x+2])<<2)|quant2(in[x+3]);
+    packTail2(in,width,x,out);
+}
+static inline __m128i sse2Nibbles(const uint8_t *in)
+{
+    __m128i v=_mm_loadu_si128((const __m128i *)in);
+    return _mm_or_si128(_mm_and_si128(v,_mm_set1_epi16(0x00F0)),_mm_srli_epi16(v,12));
+}
+static void sse2Pack4(const uint8_t *in, int width, uint8_t *out)
+{
+    int x=0;
+    for(;x+32<=width;x+=32)
+    {
+        _mm_storeu_si128((__m128i *)out,_mm_packus_epi16(sse2Nibbles(in+x),sse2Nibbles(in+x+16)));
+        out+=16;
+    }
+    for(;x+2<=width;x+=2)
+        *out++=(in[x]&0xF0)|(in[x+1]>>4);
+    packTail4(in,width,x,out);
+}
+#endif
+
+#if defined(__ARM_NEON)
+//-- NEON, the interleaved loads do the pixel shuffling
+
+static void neonPack2(const uint8_t *in, int width, uint8_t *out)
+{
+    int x=0;
+    const uint8x16_t bias=vdupq_n_u8(31);
+    for(;x+64<=width;x+=64)
+    {
+        uint8x16x4_t d=vld4q_u8(in+x);
+        uint8x16_t q0=vshrq_n_u8(vqaddq_u8(d.val[0],bias),6);
+        uint8x16_t q1=vshrq_n_u8(vqaddq_u8(d.val[1],bias),6);
+        uint8x16_t q2=vshrq_n_u8(vqaddq_u8(d.val[2],bias),6);
+        uint8x16_t q3=vshrq_n_u8(vqaddq_u8(d.val[3],bias),6);
+        uint8x16_t r=vorrq_u8(vorrq_u8(vshlq_n_u8(q0,6),vshlq_n_u8(q1,4)),vorrq_u8(vshlq_n_u8(q2,2),q3));
+        vst1q_u8(out,r);
+        out+=16;
+    }
+    for(;x+4<=width;x+=4)
+        *out++=(quant2(in[x])<<6)|(quant2(in[x+1])<<4)|(quant2(in[x+2])<<2)|quant2(in[x+3]);
+    packTail2(in,width,x,out);
+}
+static void neonPack4(const uint8_t *in, int width, uint8_t *out)
+{
+    int x=0;
+    for(;x+32<=width;x+=32)
+    {
+        uint8x16x2_t d=vld2q_u8(in+x);
+        vst1q_u8(out,vorrq_u8(vandq_u8(d.val[0],vdupq_n_u8(0xF0)),vshrq_n_u8(d.val[1],4)));
+        out+=16;
+    }
+    for(;x+2<=width;x+=2)
+        *out++=(in[x]&0xF0)|(in[x+1]>>4);
+    packTail4(in,width,x,out);
+}
+#endif
+
+static const PackKernels kernels[]=
+{
+    {"scalar",scalarPack2,scalarPack4},
+#if defined(__SSE2__)
+    {"sse2",sse2Pack2,sse2Pack4},
+#endif
+#if defined(__ARM_NEON)
+    {"neon",neonPack2,neonPack4},
+#endif
+};
+#define NB_KERNELS ((int)(sizeof(kernels)/sizeof(kernels[0])))
+
+/**
+ * 
+ * @param nb
+ * @return all the kernels this build has, the first one being the scalar one
+ */
+const PackKernels *allPackKernels(int &nb)
+{
+    nb=NB_KERNELS;
+    return kernels;
+}
+/**
+ * Picked once : FC_PACK_KERNEL if set, otherwise the last one this cpu runs
+ * @return 
+ */
+static const PackKernels *selectKernels()
+{
+    const char *forced=getenv("FC_PACK_KERNEL");
+    if(forced)
+        for(int i=0;i<NB_KERNELS;i++)
+            if(!strcmp(forced,kernels[i].name)) return kernels+i;
+    int best=0;
+    for(int i=1;i<NB_KERNELS;i++)
+    {
+#if defined(__SSE2__) && (defined(__i386__) || defined(__x86_64__))
+        if(!strcmp(kernels[i].name,"sse2") && !__builtin_cpu_supports("sse2")) continue;
+#endif
+        best=i;
+    }
+    return kernels+best;
+}
+const PackKernels &packKernels()
+{
+    static const PackKernels *selected=selectKernels(); // thread safe init
+    return *selected;
+}
+
+/**
+ * Append one row of 8 bits gray pixels, packed to bpp
+ * @param gray
+ * @param width
+ * @param bpp 1 : already packed (FreeType mono), 2, 4 or 8
+ * @param kernels
+ */
+void BitPusher::addRow(const uint8_t *gray, int width, int bpp, const PackKernels &kernels)
+{
+    switch(bpp)
+    {
+        case 1: addPacked(gray,width);break;
+        case 8: addPacked(gray,width*8);break;
+        default:
+        {
+            int sz=(width*bpp+7)>>3;
+            if((int)row.size()<sz) row.resize(sz);
+            if(bpp==2) kernels.pack2(gray,width,row.data());
+            else       kernels.pack4(gray,width,row.data());
+            addPacked(row.data(),width*bpp);
+        }
+        break;
+    }
+}
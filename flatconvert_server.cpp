@@ -0,0 +1,380 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "libflatconvert.h"
+#include "thread"
+#include "unistd.h"
+#include "sys/socket.h"
+#include "sys/stat.h"
+#include "sys/un.h"
+#include "signal.h"
+
+// Protocol, one request per connection, each message being a little endian
+// u32 length followed by that many bytes (BlobWriter layout) :
+//   request  : FC_SERVER_MAGIC, client working directory, nb args, args (argv[1..])
+//   response : FC_SERVER_MAGIC, FcStatus, error, nb files, (name, content) per file
+// Strings are a u32 length followed by the bytes. The client writes the files,
+// names being relative to its own working directory.
+#define FC_SERVER_MAGIC     0x53524346 // "FCRS"
+#define FC_SERVER_MAX_MESSAGE (1024*1024*1024)
+#define FC_SERVER_BACKLOG   16
+
+/**
+ * 
+ * @param budget bytes
+ */
+FaceCache::FaceCache(int64_t xbudget)
+{
+    budget=xbudget;
+    used=0;
+    hits=misses=0;
+}
+FaceCache::~FaceCache()
+{
+    for(auto &e : entries)
+        delete e.pool;
+}
+/**
+ * Path, size and date : the same key means the same font content
+ * @param fontFile
+ * @return empty if the file cannot be read
+ */
+std::string FaceCache::fontKey(const std::string &fontFile)
+{
+    struct stat st;
+    if(stat(fontFile.c_str(),&st)) return std::string();
+    char stamp[64];
+    sprintf(stamp,"|%lld|%lld",(long long)st.st_size,(long long)st.st_mtime);
+    return fontFile+stamp;
+}
+/**
+ * A pool for that font, warm if the cache has one, the caller gives it back
+ * with give() once done
+ * @param fontFile absolute path
+ * @return never NULL, the font is only loaded by the first activate()
+ */
+FacePool *FaceCache::take(const std::string &fontFile)
+{
+    std::string key=fontKey(fontFile);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for(auto it=entries.begin();it!=entries.end();it++)
+        {
+            if(it->key!=key) continue;
+            FacePool *pool=it->pool;
+            used-=it->cost;
+            entries.erase(it);
+            hits++;
+            return pool;
+        }
+        misses++;
+    }
+    return new FacePool(fontFile);
+}
+/**
+ * Back in the cache as the most recently used, the oldest ones are
+ * dropped until the budget is met again
+ * @param pool
+ */
+void FaceCache::give(FacePool *pool)
+{
+    Entry e;
+    e.key=fontKey(pool->getFontFile());
+    e.pool=pool;
+    e.cost=pool->memoryCost();
+    if(!e.key.size() || e.cost>budget)
+    {
+        delete pool;
+        return;
+    }
+    std::vector<FacePool *> dropped;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        entries.push_front(e);
+        used+=e.cost;
+        while(used>budget)
+        {
+            used-=entries.back().cost;
+            dropped.push_back(entries.back().pool);
+            entries.pop_back();
+        }
+    }
+    for(FacePool *p : dropped) delete p; // FreeType teardown outside of the lock
+}
+
+/**
+ * A peer gone away is an error, not a SIGPIPE killing the whole server
+ */
+static bool writeAll(int fd, const uint8_t *data, size_t size)
+{
+    while(size)
+    {
+        ssize_t nb=send(fd,data,size,MSG_NOSIGNAL);
+        if(nb<=0) return false;
+        data+=nb;
+        size-=nb;
+    }
+    return true;
+}
+static bool readAll(int fd, uint8_t *data, size_t size)
+{
+    while(size)
+    {
+        ssize_t nb=read(fd,data,size);
+        if(nb<=0) return false;
+        data+=nb;
+        size-=nb;
+    }
+    return true;
+}
+/**
+ * One length prefixed message
+ */
+static bool sendMessage(int fd, const std::vector<uint8_t> &message)
+{
+    BlobWriter w;
+    w.u32(message.size());
+    return writeAll(fd,w.data.data(),4) && writeAll(fd,message.data(),message.size());
+}
+static bool receiveMessage(int fd, std::vector<uint8_t> &message)
+{
+    std::vector<uint8_t> header(4);
+    if(!readAll(fd,header.data(),4)) return false;
+    BlobReader r(header);
+    uint32_t size=r.u32();
+    if(size>FC_SERVER_MAX_MESSAGE) return false;
+    message.resize(size);
+    return readAll(fd,message.data(),size);
+}
+static void putString(BlobWriter &w, const std::string &s)
+{
+    w.u32(s.size());
+    w.bytes((const uint8_t *)s.data(),s.size());
+}
+static std::string getString(BlobReader &r)
+{
+    uint32_t size=r.u32();
+    const uint8_t *p=r.bytes(size);
+    return p ? std::string((const char *)p,size) : std::string();
+}
+/**
+ * Paths the server opens itself are relative to the client
+ */
+static void makeAbsolute(std::string &path, const std::string &cwd)
+{
+    if(path.size() && path[0]!='/') path=cwd+"/"+path;
+}
+/**
+ * One client : parse its command line, convert with a warm face, send back
+ * the files it has to write
+ * @param fd
+ * @param cache
+ * @param parser
+ */
+static void serveClient(int fd, FaceCache &cache, const JobParser &parser)
+{
+    std::vector<uint8_t> request;
+    if(!receiveMessage(fd,request))
+    {
+        close(fd);
+        return;
+    }
+    BlobReader r(request);
+    FcResult result;
+    std::vector<std::pair<std::string,std::vector<uint8_t>>> files;
+    std::string cwd;
+    std::vector<std::string> args;
+    if(r.u32()==FC_SERVER_MAGIC)
+    {
+        cwd=getString(r);
+        int nb=r.u32();
+        for(int i=0;i<nb && !r.failed;i++)
+            args.push_back(getString(r));
+    }else
+        r.failed=true;
+
+    FontJob job;
+    if(r.failed)
+    {
+        result.status=FC_ERROR_PARAMETERS;
+        result.error="invalid request";
+    }else if(!parser(args,job,result.error))
+    {
+        result.status=FC_ERROR_PARAMETERS;
+    }else
+    {
+        makeAbsolute(job.fontFile,cwd);
+        makeAbsolute(job.cacheDir,cwd);
+        makeAbsolute(job.frequencyFile,cwd);
+        for(int i=0;i<(int)job.corpusFiles.size();i++)
+            makeAbsolute(job.corpusFiles[i],cwd);
+        job.sideFiles=false;
+        job.faces=cache.take(job.fontFile);
+        fcConvertFile(job,result);
+        cache.give(job.faces);
+        job.faces=NULL;
+        if(result.status==FC_OK)
+        {
+            files.push_back(std::make_pair(job.outputFile,std::vector<uint8_t>(result.header.begin(),result.header.end())));
+            if(job.statsFile.size())
+            {
+                std::string json=job.statsJson();
+                files.push_back(std::make_pair(job.statsFile,std::vector<uint8_t>(json.begin(),json.end())));
+            }
+            // side files need a single variant, prepare() checked it
+            if(result.fonts.size() && result.fonts[0].blob.size())
+            {
+                const std::vector<uint8_t> &blob=result.fonts[0].blob;
+                if(job.blobFile.size())
+                    files.push_back(std::make_pair(job.blobFile,blob));
+                if(job.bitmapFile.size())
+                {
+                    const PFXblobHeader *h=(const PFXblobHeader *)blob.data();
+                    files.push_back(std::make_pair(job.bitmapFile,
+                        std::vector<uint8_t>(blob.begin()+h->bitmapOffset,blob.begin()+h->bitmapOffset+h->bitmapSize)));
+                }
+            }
+        }
+    }
+    printf("%s : %s (faces : %d hits, %d misses)\n",job.fontFile.c_str(),fcStatusName(result.status),cache.hits,cache.misses);
+    fflush(stdout);
+
+    BlobWriter w;
+    w.u32(FC_SERVER_MAGIC);
+    w.u32(result.status);
+    putString(w,result.error);
+    w.u32(files.size());
+    for(auto &f : files)
+    {
+        putString(w,f.first);
+        w.u32(f.second.size());
+        w.bytes(f.second.data(),f.second.size());
+    }
+    sendMessage(fd,w.data);
+    close(fd);
+}
+/**
+ * Listen on a Unix socket until killed, each connection being served by
+ * its own thread
+ * @param socketPath
+ * @param cacheMb face cache budget
+ * @param parser command line => job, the same as flatconvert's
+ * @return exit code, only on setup failure
+ */
+int runServer(const std::string &socketPath, int cacheMb, const JobParser &parser)
+{
+    struct sockaddr_un addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family=AF_UNIX;
+    if(socketPath.size()>=sizeof(addr.sun_path))
+    {
+        printf("Socket path too long : %s\n",socketPath.c_str());
+        return 1;
+    }
+    strcpy(addr.sun_path,socketPath.c_str());
+    int fd=socket(AF_UNIX,SOCK_STREAM,0);
+    if(fd<0)
+    {
+        printf("Cannot create socket\n");
+        return 1;
+    }
+    // left by an earlier server, anything else at that path is not ours to delete
+    struct stat st;
+    if(!lstat(socketPath.c_str(),&st) && S_ISSOCK(st.st_mode))
+        unlink(socketPath.c_str());
+    if(bind(fd,(struct sockaddr *)&addr,sizeof(addr)) || listen(fd,FC_SERVER_BACKLOG))
+    {
+        printf("Cannot listen on %s\n",socketPath.c_str());
+        close(fd);
+        return 1;
+    }
+    chmod(socketPath.c_str(),0600); // the server reads & writes files on behalf of its clients
+    signal(SIGPIPE,SIG_IGN); // belt and braces, replies are sent with MSG_NOSIGNAL
+    printf("Serving on %s, face cache %d MB\n",socketPath.c_str(),cacheMb);
+    fflush(stdout);
+    FaceCache cache((int64_t)cacheMb*1024*1024);
+    while(1)
+    {
+        int client=accept(fd,NULL,NULL);
+        if(client<0) continue;
+        std::thread(serveClient,client,std::ref(cache),std::cref(parser)).detach();
+    }
+    return 0;
+}
+/**
+ * Hand the command line over to a server and write the files it sends back
+ * @param socketPath
+ * @param args command line, without the program name
+ * @param status FcStatus of the conversion
+ * @return false if there is no server there, the conversion is then to be done locally
+ */
+bool runClient(const std::string &socketPath, const std::vector<std::string> &args, int &status)
+{
+    struct sockaddr_un addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family=AF_UNIX;
+    if(socketPath.size()>=sizeof(addr.sun_path)) return false;
+    strcpy(addr.sun_path,socketPath.c_str());
+    int fd=socket(AF_UNIX,SOCK_STREAM,0);
+    if(fd<0) return false;
+    if(connect(fd,(struct sockaddr *)&addr,sizeof(addr)))
+    {
+        close(fd);
+        return false;
+    }
+    char cwd[4096];
+    if(!getcwd(cwd,sizeof(cwd)))
+    {
+        close(fd);
+        return false;
+    }
+    BlobWriter w;
+    w.u32(FC_SERVER_MAGIC);
+    putString(w,cwd);
+    w.u32(args.size());
+    for(int i=0;i<(int)args.size();i++)
+        putString(w,args[i]);
+    std::vector<uint8_t> response;
+    bool ok=sendMessage(fd,w.data) && receiveMessage(fd,response);
+    close(fd);
+    if(!ok) return false;
+
+    BlobReader r(response);
+    if(r.u32()!=FC_SERVER_MAGIC) return false;
+    status=r.u32();
+    std::string error=getString(r);
+    int nb=r.u32();
+    for(int i=0;i<nb && !r.failed;i++)
+    {
+        std::string name=getString(r);
+        uint32_t size=r.u32();
+        const uint8_t *content=r.bytes(size);
+        if(!content) break;
+        printf("Writing file %s\n",name.c_str());
+        if(!writeIfChanged(name,content,size))
+        {
+            printf("Cannot write %s\n",name.c_str());
+            status=FC_ERROR_OUTPUT;
+        }
+    }
+    if(r.failed) return false;
+    if(status!=FC_OK)
+        printf("Failed (%s) : %s\n",fcStatusName((FcStatus)status),error.c_str());
+    return true;
+}
+// EOF
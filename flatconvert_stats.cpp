@@ -0,0 +1,141 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "flatconvert.h"
+#include "sys/resource.h"
+
+/**
+ * Peak resident memory of the process so far
+ * @return kB, 0 if unknown
+ */
+int64_t fcPeakMemoryKb()
+{
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF,&usage)) return 0;
+#if defined(__APPLE__)
+    return usage.ru_maxrss/1024; // bytes there
+#else
+    return usage.ru_maxrss;
+#endif
+}
+/**
+ * --stats entry of a glyph, taken when assembling the bitmap
+ * @param code
+ * @param e
+ * @param cached true if it came from the glyph cache
+ * @return 
+ */
+GlyphStats FontConverter::describeGlyph(uint32_t code, const EncodedGlyph &e, bool cached)
+{
+    static const char *encodings[4]={"raw","rle","heatshrink","dictionary"};
+    GlyphStats s;
+    s.code=code;
+    s.width=e.glyph.width;
+    s.height=e.glyph.height;
+    s.inked=-1;
+    if(!format)
+    {
+        // the blank rows left out by trimGaps are not in raw
+        int pixels=s.width*(s.height-e.gapLength);
+        s.inked=0;
+        for(int p=0;p<pixels;p++)
+            if(pfxPackedPixel(e.raw.data(),p,bpp)) s.inked++;
+    }
+    s.rawBytes=e.rawSize;
+    s.storedBytes=e.data.size()+(e.gapLength ? 2 : 0);
+    if(adaptive)
+        s.encoding=encodings[e.glyph.flags&PFX_GLYPH_ENCODING_MASK];
+    else if(compressed)
+        s.encoding=useDictionary ? "dictionary" : "heatshrink";
+    else
+        s.encoding="raw";
+    s.shared=false;
+    s.cached=cached;
+    s.loadMs=e.loadMs;
+    s.renderMs=e.renderMs;
+    s.packMs=e.packMs;
+    return s;
+}
+/**
+ * Quoted JSON string
+ */
+static std::string jsonString(const std::string &in)
+{
+    std::string out="\"";
+    for(int i=0;i<(int)in.size();i++)
+    {
+        unsigned char c=in[i];
+        if(c=='"' || c=='\\')
+        {
+            out+='\\';
+            out+=(char)c;
+        }else if(c<0x20)
+        {
+            char hex[8];
+            sprintf(hex,"\\u%04x",c);
+            out+=hex;
+        }else
+            out+=(char)c;
+    }
+    return out+"\"";
+}
+/**
+ * Timings & sizes of all the variants of the last run(), one glyph per line
+ * so that runs can be compared with line based tools too
+ * @return JSON text
+ */
+std::string FontJob::statsJson()
+{
+    std::string out;
+    char line[512];
+    out+="{\n  \"font\": "+jsonString(fontFile)+",\n";
+    sprintf(line,"  \"peak_memory_kb\": %lld,\n  \"variants\": [\n",(long long)fcPeakMemoryKb());
+    out+=line;
+    for(int v=0;v<(int)stats.size();v++)
+    {
+        const ConversionStats &s=stats[v];
+        out+="    {\"symbol\": "+jsonString(s.symbol)+",\n";
+        sprintf(line,"     \"size\": %d, \"bpp\": %d, \"glyphs\": %d, \"peak_memory_kb\": %lld,\n",
+                s.size,s.bpp,s.nbGlyphs,(long long)s.peakKb);
+        out+=line;
+        sprintf(line,"     \"ms\": {\"freetype_init\": %.3f, \"face_load\": %.3f, \"glyph_load\": %.3f, \"render\": %.3f, "
+                     "\"pack\": %.3f, \"compress\": %.3f, \"emit\": %.3f},\n",
+                s.initMs,s.loadMs-s.initMs,s.glyphLoadMs,s.renderMs,s.packMs,s.compressMs,s.emitMs);
+        out+=line;
+        sprintf(line,"     \"bytes\": {\"render\": %lld, \"pack\": %lld, \"compress\": %lld, \"emit\": %lld},\n",
+                (long long)s.renderBytes,(long long)s.packBytes,(long long)s.compressBytes,(long long)s.emitBytes);
+        out+=line;
+        out+="     \"glyph_stats\": [\n";
+        for(int i=0;i<(int)s.glyphs.size();i++)
+        {
+            const GlyphStats &g=s.glyphs[i];
+            sprintf(line,"      {\"code\": %u, \"char\": %s, \"width\": %d, \"height\": %d, \"pixels\": %d, \"inked\": %d, "
+                         "\"raw_bytes\": %d, \"stored_bytes\": %d, \"encoding\": \"%s\", \"shared\": %s, \"cached\": %s, "
+                         "\"load_us\": %.1f, \"render_us\": %.1f, \"pack_us\": %.1f}%s\n",
+                    g.code,jsonString(FontConverter::printable(g.code)).c_str(),g.width,g.height,g.width*g.height,g.inked,
+                    g.rawBytes,g.storedBytes,g.encoding,g.shared ? "true" : "false",g.cached ? "true" : "false",
+                    g.loadMs*1000.,g.renderMs*1000.,g.packMs*1000.,i+1<(int)s.glyphs.size() ? "," : "");
+            out+=line;
+        }
+        out+="     ]}";
+        out+=v+1<(int)stats.size() ? ",\n" : "\n";
+    }
+    out+="  ]\n}\n";
+    return out;
+}
+// EOF
@@ -0,0 +1,307 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "flatconvert.h"
+#include "thread"
+#include "condition_variable"
+#include "unordered_map"
+#include "unistd.h"
+
+/**
+ * FNV-1a of the stored bytes of a glyph, to find dedup candidates without
+ * keeping the bytes themselves
+ * @param bytes
+ * @return 
+ */
+static uint64_t hashBytes(const std::vector<uint8_t> &bytes)
+{
+    uint64_t hash=0xcbf29ce484222325ULL;
+    for(int i=0;i<(int)bytes.size();i++)
+    {
+        hash^=bytes[i];
+        hash*=0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Bounded memory conversion, for fonts with tens of thousands of glyphs.
+ * The workers render, trim, lay out and compress each glyph on its own in a
+ * ring of FC_STREAM_WINDOW slots, never getting further ahead than that.
+ * This thread takes the glyphs in order, draws each one back to check it,
+ * appends its bytes to the spool file and recycles the slot, buffers
+ * included. Only the index (glyph table, offsets) grows with the glyph count,
+ * the bitmap is read back from the spool when emitted.
+ * The dictionary and the parameter search need all the glyphs, so does the
+ * atlas, the glyph cache keeps them all : none of them can stream
+ * @return
+ */
+bool FontConverter::convertStreaming()
+{
+    if(useDictionary || hsSearch || atlasWidth || cacheDir.size())
+    {
+        printf("Streaming compresses each glyph on its own : no dictionary, parameter search, atlas or glyph cache\n");
+        return false;
+    }
+    spool=tmpfile();
+    if(!spool)
+    {
+        printf("Cannot create the bitmap spool file\n");
+        return false;
+    }
+    spoolSize=0;
+    const std::vector<uint32_t> &codes=codePoints;
+    int nb=codes.size();
+    int window=FC_STREAM_WINDOW;
+    std::vector<EncodedGlyph> slots(window);
+
+    std::mutex lock;
+    std::condition_variable changed;
+    std::vector<bool> ready(window,false); // under lock
+    int written=0;                         // same
+    std::atomic<bool> failed(false);
+    faces->reserve(nbThreads);
+    double initBefore=faces->initMs();
+    std::vector<FT_Face> workerFaces(nbThreads,(FT_Face)NULL);
+    std::vector<std::unique_ptr<BitPusher> > scratchPushers(nbThreads);
+    std::vector<std::unique_ptr<HsCompressor> > compressors(nbThreads);
+    std::vector<double> loadMs(nbThreads,0);
+    auto fail=[&]()
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        failed=true;
+        changed.notify_all();
+        return false;
+    };
+    auto produce=[&](int worker, int i)
+    {
+        if(!workerFaces[worker])
+        {
+            auto start=std::chrono::steady_clock::now();
+            workerFaces[worker]=faces->activate(worker,fontSize);
+            if(worker) loadMs[worker]=fcElapsedMs(start);
+            if(!workerFaces[worker]) return fail();
+            scratchPushers[worker].reset(new BitPusher);
+            if(compressed)
+                compressors[worker].reset(new HsCompressor(hsWindow,hsLookahead));
+        }
+        {
+            // the slot is free once the glyph window places before is written
+            std::unique_lock<std::mutex> hold(lock);
+            changed.wait(hold,[&]{return failed || i<written+window;});
+            if(failed) return false;
+        }
+        EncodedGlyph &e=slots[i%window];
+        bool ok=convertGlyph(workerFaces[worker],codes[i],*scratchPushers[worker],e);
+        if(ok && e.rendered)
+        {
+            if(trim)
+                trimGlyph(e);
+            if(format)
+                toDisplayFormat(e);
+            if(compressed)
+            {
+                auto start=std::chrono::steady_clock::now();
+                ok=compressGlyph(e,*compressors[worker]);
+                e.compressMs=fcElapsedMs(start);
+            }
+        }
+        if(!ok)
+            return fail();
+        std::lock_guard<std::mutex> hold(lock);
+        ready[i%window]=true;
+        changed.notify_all();
+        return true;
+    };
+    // the workers run on their own thread, this one writes the glyphs as they come
+    std::thread producer([&]()
+    {
+        if(!runParallel(nb,nbThreads,produce))
+            fail();
+    });
+
+    PFXglyph zeroGlyph= (PFXglyph){0,0,0,0,0,0,0};
+    std::unordered_multimap<uint64_t,uint32_t> stored; // dedup : hash => spool offset
+    std::vector<uint8_t> bytes,readBack,scratch,pixels;
+    bool ok=true;
+    stats.glyphs.clear();
+    for(int i=0;i<nb && ok;i++)
+    {
+        {
+            std::unique_lock<std::mutex> hold(lock);
+            changed.wait(hold,[&]{return failed || ready[i%window];});
+            if(!ready[i%window])
+                break;
+        }
+        EncodedGlyph &e=slots[i%window];
+        stats.glyphLoadMs+=e.loadMs;
+        stats.renderMs+=e.renderMs;
+        stats.packMs+=e.packMs;
+        stats.compressMs+=e.compressMs;
+        stats.renderBytes+=e.renderedBytes;
+        if(!e.rendered)
+        {
+            bitmapOffsets.push_back(0);
+            listOfGlyphs.push_back(zeroGlyph);
+        }else
+        {
+            if(glyphStats)
+                stats.glyphs.push_back(describeGlyph(codes[i],e,false));
+            _totalUncompressedSize+=e.rawSize;
+            bytes.clear();
+            if(e.gapLength)
+            {
+                bytes.push_back(e.gapStart);
+                bytes.push_back(e.gapLength);
+            }
+            bytes.insert(bytes.end(),e.data.begin(),e.data.end());
+            bool shared=false;
+            uint32_t offset=spoolSize;
+            uint64_t hash=0;
+            if(dedup && bytes.size())
+            {
+                hash=hashBytes(bytes);
+                auto range=stored.equal_range(hash);
+                for(auto it=range.first;it!=range.second && !shared;it++)
+                    if(spoolEquals(it->second,bytes,readBack))
+                    {
+                        offset=it->second;
+                        shared=true;
+                    }
+            }
+            if(shared)
+            {
+                if(glyphStats) stats.glyphs.back().shared=true;
+                _dedupGlyphs++;
+                _dedupBytes+=bytes.size();
+            }else if(bytes.size())
+            {
+                if(fwrite(bytes.data(),bytes.size(),1,spool)!=1)
+                {
+                    printf("Cannot write the bitmap spool file\n");
+                    ok=false;
+                }
+                spoolSize+=bytes.size();
+                if(dedup)
+                    stored.insert(std::make_pair(hash,offset));
+            }
+            if(ok && e.glyph.width && e.glyph.height)
+            {
+                // a font of this glyph alone, the index is checked once complete
+                PFXglyph glyph=e.glyph;
+                glyph.bitmapOffset=0;
+                PFXfont font;
+                describeFont(font);
+                font.bitmap=bytes.data();
+                font.glyph=&glyph;
+                int need=pfxGlyphSize(&glyph,font.bpp)+1;
+                if((int)scratch.size()<need) scratch.resize(need);
+                ok=verifyGlyph(font,&glyph,e,codes[i],scratch,pixels);
+            }
+            bitmapOffsets.push_back(offset);
+            listOfGlyphs.push_back(e.glyph);
+        }
+        e.clear();
+        std::lock_guard<std::mutex> hold(lock);
+        ready[i%window]=false;
+        written=i+1;
+        if(!ok) failed=true;
+        changed.notify_all();
+    }
+    producer.join();
+    if(failed || !ok)
+        return false;
+
+    for(int i=1;i<nbThreads;i++)
+        stats.loadMs+=loadMs[i];
+    stats.initMs+=faces->initMs()-initBefore;
+    stats.nbGlyphs=nb;
+    face_height= face->size->metrics.height >> 6;
+    stats.packBytes=_totalUncompressedSize;
+    stats.compressBytes=spoolSize;
+    if(!layoutOffsets())
+        return false;
+    if(kerning && !extractKerning())
+        return false;
+    if(!verifyIndex())
+        return false;
+    stats.peakKb=fcPeakMemoryKb();
+    return true;
+}
+/**
+ * Call fn on the spooled bitmap, chunk after chunk, then go back to appending
+ * @param fn returns false to stop
+ * @return false on a read error or if fn stopped
+ */
+bool FontConverter::readSpool(const std::function<bool(const uint8_t *,int)> &fn)
+{
+    std::vector<uint8_t> chunk(FC_EMIT_CHUNK);
+    bool ok=!fflush(spool) && !fseeko(spool,0,SEEK_SET);
+    int64_t left=spoolSize;
+    while(ok && left>0)
+    {
+        int nb=left>FC_EMIT_CHUNK ? FC_EMIT_CHUNK : left;
+        ok=fread(chunk.data(),nb,1,spool)==1 && fn(chunk.data(),nb);
+        left-=nb;
+    }
+    fseeko(spool,0,SEEK_END);
+    return ok;
+}
+/**
+ * Dedup candidate, are the bytes at offset in the spool the same ?
+ * @param offset
+ * @param bytes
+ * @param buffer read back there
+ * @return
+ */
+bool FontConverter::spoolEquals(uint32_t offset, const std::vector<uint8_t> &bytes, std::vector<uint8_t> &buffer)
+{
+    if(offset+bytes.size()>spoolSize)
+        return false;
+    buffer.resize(bytes.size());
+    bool same=!fflush(spool) && !fseeko(spool,offset,SEEK_SET) &&
+              fread(buffer.data(),bytes.size(),1,spool)==1 && buffer==bytes;
+    fseeko(spool,0,SEEK_END);
+    return same;
+}
+/**
+ * Write before, the spooled bitmap and padding zeros to file, aside then
+ * only replacing it if the content changed
+ * @param file
+ * @param before
+ * @param padding
+ * @return false on write error
+ */
+bool FontConverter::writeSpooled(const std::string &file, const std::vector<uint8_t> &before, int padding)
+{
+    std::string tmp=tmpFileName(file,this);
+    FILE *f=fopen(tmp.c_str(),"wb");
+    if(!f) return false;
+    static const uint8_t zeros[4]={0,0,0,0};
+    bool ok=(!before.size() || fwrite(before.data(),before.size(),1,f)==1) &&
+            readSpool([&](const uint8_t *chunk, int nb) {return fwrite(chunk,nb,1,f)==1;}) &&
+            (!padding || fwrite(zeros,padding,1,f)==1);
+    if(fclose(f)) ok=false;
+    if(!ok)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return replaceIfChanged(tmp,file);
+}
+// EOF
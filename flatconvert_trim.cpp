@@ -0,0 +1,129 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "flatconvert.h"
+
+/**
+ * Anti aliased renders often come with blank edges, even more so once
+ * quantized to 2 or 4 bpp. Crop the glyph to its inked pixels and move the
+ * offsets accordingly. With trimGaps, the longest run of blank rows inside
+ * the glyph (i, j, :, = ...) is left out too, see PFX_GLYPH_ROW_GAP
+ * Runs on the packed glyph, before any display format conversion
+ * @param e
+ */
+void FontConverter::trimGlyph(EncodedGlyph &e)
+{
+    int w=e.glyph.width,h=e.glyph.height;
+    if(!w || !h) return;
+    int minX=w,maxX=-1,minY=h,maxY=-1;
+    for(int y=0;y<h;y++)
+        for(int x=0;x<w;x++)
+            if(pfxPackedPixel(e.raw.data(),y*w+x,bpp))
+            {
+                if(x<minX) minX=x;
+                if(x>maxX) maxX=x;
+                if(y<minY) minY=y;
+                if(y>maxY) maxY=y;
+            }
+    int before=e.raw.size();
+    if(maxX<0)
+    {
+        // nothing left once quantized, only the advance matters
+        e.glyph.width=e.glyph.height=0;
+        e.raw.clear();
+    }else if((minX || minY || maxX<w-1 || maxY<h-1) && e.glyph.xOffset+minX<=127 && e.glyph.yOffset+minY<=127)
+    {
+        int nw=maxX-minX+1,nh=maxY-minY+1;
+        std::vector<uint8_t> out((nw*nh*bpp+7)/8,0);
+        for(int y=0;y<nh;y++)
+            for(int x=0;x<nw;x++)
+                pfxPutPixel(out.data(),y*nw+x,bpp,pfxPackedPixel(e.raw.data(),(y+minY)*w+x+minX,bpp));
+        e.glyph.width=nw;
+        e.glyph.height=nh;
+        e.glyph.xOffset+=minX;
+        e.glyph.yOffset+=minY;
+        e.raw=out;
+    }
+    if(e.raw.size()<(size_t)before)
+    {
+        _trimGlyphs++;
+        _trimBytes+=before-e.raw.size();
+    }
+
+    w=e.glyph.width;
+    h=e.glyph.height;
+    if(trimGaps && !format && !atlasWidth && h>2)
+    {
+        // longest run of blank rows, the first & last ones are inked now
+        int bestStart=0,bestLength=0;
+        for(int y=1;y<h-1;)
+        {
+            int length=0;
+            while(y+length<h-1)
+            {
+                bool blank=true;
+                for(int x=0;x<w && blank;x++)
+                    if(pfxPackedPixel(e.raw.data(),(y+length)*w+x,bpp)) blank=false;
+                if(!blank) break;
+                length++;
+            }
+            if(length>bestLength)
+            {
+                bestStart=y;
+                bestLength=length;
+            }
+            y+=length+1;
+        }
+        int full=e.raw.size();
+        int stored=2+((w*(h-bestLength)*bpp+7)>>3); // with the 2 bytes header
+        if(bestLength && stored<full)
+        {
+            std::vector<uint8_t> out(stored-2,0);
+            int o=0;
+            for(int y=0;y<h;y++)
+            {
+                if(y>=bestStart && y<bestStart+bestLength) continue;
+                for(int x=0;x<w;x++)
+                    pfxPutPixel(out.data(),o++,bpp,pfxPackedPixel(e.raw.data(),y*w+x,bpp));
+            }
+            e.raw=out;
+            e.gapStart=bestStart;
+            e.gapLength=bestLength;
+            e.glyph.flags|=PFX_GLYPH_ROW_GAP;
+            _gapGlyphs++;
+            _gapBytes+=full-stored;
+        }
+    }
+    e.rawSize=e.raw.size();
+    e.data=e.raw;
+}
+/**
+ * The glyph raw/data describe : without the row gap
+ * @param e
+ * @return
+ */
+PFXglyph FontConverter::storedGlyph(const EncodedGlyph &e)
+{
+    PFXglyph stored=e.glyph;
+    if(e.gapLength)
+    {
+        stored.height-=e.gapLength;
+        stored.flags&=~PFX_GLYPH_ROW_GAP;
+    }
+    return stored;
+}
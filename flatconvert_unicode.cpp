@@ -0,0 +1,104 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "flatconvert.h"
+
+/**
+ * Decode an UTF-8 string into code points
+ * @param in
+ * @param out
+ * @param error
+ * @return false if the string is not valid UTF-8
+ */
+bool utf8Decode(const std::string &in, std::vector<uint32_t> &out, std::string &error)
+{
+    const uint8_t *p=(const uint8_t *)in.c_str();
+    const uint8_t *end=p+in.size();
+    while(p<end)
+    {
+        uint32_t c=*p++;
+        if(c<0x80)
+        {
+            out.push_back(c);
+            continue;
+        }
+        int extra;
+        uint32_t min;
+        if((c&0xE0)==0xC0)      { extra=1;c&=0x1F;min=0x80;}
+        else if((c&0xF0)==0xE0) { extra=2;c&=0x0F;min=0x800;}
+        else if((c&0xF8)==0xF0) { extra=3;c&=0x07;min=0x10000;}
+        else
+        {
+            error="invalid UTF-8 lead byte";
+            return false;
+        }
+        if(end-p<extra)
+        {
+            error="truncated UTF-8 sequence";
+            return false;
+        }
+        for(int i=0;i<extra;i++)
+        {
+            if((p[i]&0xC0)!=0x80)
+            {
+                error="invalid UTF-8 continuation byte";
+                return false;
+            }
+            c=(c<<6)|(p[i]&0x3F);
+        }
+        p+=extra;
+        if(c<min || c>FC_MAX_CODEPOINT || (c>=0xD800 && c<=0xDFFF))
+        {
+            error="invalid code point in UTF-8 string";
+            return false;
+        }
+        out.push_back(c);
+    }
+    return true;
+}
+
+/**
+ * 
+ * @param c
+ * @return UTF-8 encoded version of c
+ */
+std::string utf8Encode(uint32_t c)
+{
+    std::string s;
+    if(c<0x80)
+    {
+        s+=(char)c;
+    }else if(c<0x800)
+    {
+        s+=(char)(0xC0|(c>>6));
+        s+=(char)(0x80|(c&0x3F));
+    }else if(c<0x10000)
+    {
+        s+=(char)(0xE0|(c>>12));
+        s+=(char)(0x80|((c>>6)&0x3F));
+        s+=(char)(0x80|(c&0x3F));
+    }else
+    {
+        s+=(char)(0xF0|(c>>18));
+        s+=(char)(0x80|((c>>12)&0x3F));
+        s+=(char)(0x80|((c>>6)&0x3F));
+        s+=(char)(0x80|(c&0x3F));
+    }
+    return s;
+}
+// EOF
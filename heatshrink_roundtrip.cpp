@@ -0,0 +1,114 @@
+/*
+Round trip of the heatshrink encoder (hs/heatshrink) through the decoder of
+pfxdecoder.h, for every window the converter accepts.
+
+heatshrink starts with a zeroed window, so its back references can reach
+before the start of the glyph, e.g. when the first rows are blank. The
+samples are glyph like bitmaps, most of them starting with blank rows.
+
+  heatshrink_roundtrip
+*/
+#include "flatconvert.h"
+#include "pfxdecoder.h"
+
+#define RT_SAMPLES 24
+
+/**
+ * Same samples on every platform : own generator, not rand()
+ * 8 bpp glyphs of 1..40 x 1..48 pixels, mostly black & white with some edges
+ */
+static void makeSamples(std::vector<EncodedGlyph> &samples)
+{
+    uint32_t seed=4321;
+    auto next=[&seed]() { seed=seed*1103515245+12345; return (int)((seed>>16)&0x7FFF); };
+    for(int s=0;s<RT_SAMPLES;s++)
+    {
+        EncodedGlyph e;
+        int w=1+next()%40, h=1+next()%48;
+        int blank= s%4 ? next()%(h+1) : 0; // leading blank rows
+        if(s==1) blank=h;                   // all blank
+        e.rendered=true;
+        e.glyph.width=w;
+        e.glyph.height=h;
+        e.glyph.flags=0;
+        e.raw.assign(w*h,0);
+        for(int i=blank*w;i<w*h;i++)
+        {
+            int r=next()%8;
+            e.raw[i]= r<3 ? 0 : r<6 ? 255 : next()&0xFF;
+        }
+        e.rawSize=e.raw.size();
+        samples.push_back(e);
+    }
+}
+
+/**
+ * Decode data as the device would, through pfxDecodeGlyph
+ * The decode counters are what the footer cycle estimate is computed from,
+ * check they account for the whole stream and the whole glyph
+ * @return true if it gives back e.raw
+ */
+static bool decodesBack(const EncodedGlyph &e, const std::vector<uint8_t> &data, int shrink, int flags,
+                        int window, int lookahead, const std::vector<uint8_t> &dict)
+{
+    PFXfont font;
+    memset(&font,0,sizeof(font));
+    font.bpp=8;
+    font.shrinked=shrink;
+    font.hsWindow=window;
+    font.hsLookahead=lookahead;
+    font.dictionary=(uint8_t *)dict.data();
+    font.dictionarySize=dict.size();
+    PFXglyph glyph=e.glyph;
+    glyph.flags=flags;
+    // the decoder may read up to its input bound, past the end of the stream
+    std::vector<uint8_t> in(data);
+    in.resize(data.size()+e.raw.size()+16,0);
+    std::vector<uint8_t> out(e.raw.size()+1);
+    PFXdecodeStats st;
+    memset(&st,0,sizeof(st));
+    int got=pfxDecodeGlyph(&font,&glyph,in.data(),out.data(),&st);
+    if(got!=(int)e.raw.size() || memcmp(out.data(),e.raw.data(),got))
+        return false;
+    uint32_t bits=st.literals*9+st.backRefs*(1+window+lookahead);
+    return st.glyphs==1 && st.bytesOut==e.raw.size() && st.literals+st.bytesCopied==e.raw.size() &&
+           st.bitsRead==bits && st.bytesRead==(bits+7)/8 && st.bytesRead==data.size();
+}
+
+int main()
+{
+    std::vector<EncodedGlyph> samples;
+    makeSamples(samples);
+    int cases=0,failed=0;
+    std::vector<uint8_t> none,data;
+    for(int w=4;w<=15;w++)
+    {
+        // every window, the lookahead at both ends and halfway
+        for(int l=3;l<w;l++)
+        {
+            if(l>4 && l!=w/2 && l!=w-1) continue;
+            HsCompressor compressor(w,l);
+            std::vector<uint8_t> dict;
+            FontConverter::buildDictionary(samples,FontConverter::dictionarySize(w),dict);
+            for(int s=0;s<(int)samples.size();s++)
+            {
+                const EncodedGlyph &e=samples[s];
+                if(!compressor.compress(e.raw.data(),e.raw.size(),data))
+                    return 1;
+                bool plain=decodesBack(e,data,PFX_SHRINK_HEATSHRINK,0,w,l,none);
+                bool adaptive=decodesBack(e,data,PFX_SHRINK_ADAPTIVE,PFX_GLYPH_HEATSHRINK,w,l,none);
+                FontConverter::compressWithDictionary(e.raw,dict,w,l,data);
+                bool dictionary=decodesBack(e,data,PFX_SHRINK_DICTIONARY,0,w,l,dict);
+                cases+=3;
+                if(!plain || !adaptive || !dictionary)
+                {
+                    printf("window %2d lookahead %2d sample %2d (%dx%d) : %s%s%s\n",w,l,s,e.glyph.width,e.glyph.height,
+                           plain ? "" : " heatshrink",adaptive ? "" : " adaptive",dictionary ? "" : " dictionary");
+                    failed+=!plain+!adaptive+!dictionary;
+                }
+            }
+        }
+    }
+    printf("%d round trips, %d failed\n",cases,failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,89 @@
+/*
+TrueType to Adafruit_GFX font converter.  Derived from Peter Jakobs'
+Adafruit_ftGFX fork & makefont tool, and Paul Kourany's Adafruit_mfGFX.
+
+NOT AN ARDUINO SKETCH.  This is a command-line tool for preprocessing
+fonts to be used with the Adafruit_GFX Arduino library.
+
+For UNIX-like systems.  Outputs to stdout; redirect to header file, e.g.:
+  ./fontconvert ~/Library/Fonts/FreeSans.ttf 18 > FreeSans18pt7b.h
+
+REQUIRES FREETYPE LIBRARY.  www.freetype.org
+
+Currently this only extracts the printable 7-bit ASCII chars of a font.
+Will eventually extend with some int'l chars a la ftGFX, not there yet.
+Keep 7-bit fonts around as an option in that case, more compact.
+
+See notes at end for glyph nomenclature & other tidbits.
+*/
+#include "libflatconvert.h"
+#include "stdlib.h"
+
+/**
+ * Convert a font given in memory, the header is generated in memory too
+ * Files are only written when the job asks for them (bitmap_file, blob_file)
+ * @param job
+ * @param font font file content, must stay valid during the call
+ * @param fontSize
+ * @param result
+ * @return result.status
+ */
+FcStatus fcConvert(FontJob &job, const uint8_t *font, int fontSize, FcResult &result)
+{
+    job.fontData=font;
+    job.fontDataSize=fontSize;
+    return fcConvertFile(job,result);
+}
+/**
+ * Same thing, FreeType loading job.fontFile unless job.fontData is set
+ * @param job
+ * @param result
+ * @return result.status
+ */
+FcStatus fcConvertFile(FontJob &job, FcResult &result)
+{
+    result.error.clear();
+    result.header.clear();
+    result.fonts.clear();
+    if(!job.prepare(result.error))
+    {
+        result.status=job.status;
+        return result.status;
+    }
+    char *text=NULL;
+    size_t size=0;
+    FILE *output=open_memstream(&text,&size);
+    if(!output)
+    {
+        result.error="cannot allocate the output";
+        result.status=FC_ERROR_OUTPUT;
+        return result.status;
+    }
+    bool ok=job.convert(output,&result.fonts,result.error);
+    fclose(output); // size & text are only final once closed
+    if(ok)
+        result.header.assign(text,size);
+    free(text);
+    result.status=ok ? FC_OK : job.status;
+    if(!ok)
+        result.fonts.clear();
+    return result.status;
+}
+/**
+ * 
+ * @param status
+ * @return printable name
+ */
+const char *fcStatusName(FcStatus status)
+{
+    switch(status)
+    {
+        case FC_OK:               return "ok";
+        case FC_ERROR_PARAMETERS: return "invalid parameters";
+        case FC_ERROR_FONT:       return "cannot load font";
+        case FC_ERROR_CONVERSION: return "conversion failed";
+        case FC_ERROR_OUTPUT:     return "cannot write output";
+    }
+    return "unknown";
+}
+// EOF
@@ -0,0 +1,50 @@
+// libflatconvert : the converter as a library, for tools that already have
+// the font in memory and want the result in memory too.
+//
+//   FontJob job;                  // same fields as the command line / manifest
+//   job.fontFile="Foo.ttf";       // only names the symbols here
+//   job.size=12; job.bpp=4; job.compression=true;
+//   FcResult result;
+//   if(fcConvert(job, fontBytes, fontSize, result)!=FC_OK) ... result.error
+//   result.header                 // what -o would have written
+//   result.fonts[0].getFont(font) // PFXfont pointing inside the blob, nothing copied
+//
+// Nothing calls exit(), every failure comes back as an FcStatus plus a message.
+// Progress and warnings still go to stdout. Jobs do not share anything, one
+// thread per job is fine. The flatconvert command line is built on top of it.
+
+#pragma once
+#include "flatconvert.h"
+
+/**
+ * One size/bpp of a job
+ */
+class FcFont
+{
+public:
+                        FcFont() {size=bpp=0;}
+        std::string     symbol;
+        int             size,bpp;
+        std::vector<uint8_t> blob; // whole font, see pfxblob.h, empty for atlas fonts
+        ConversionStats stats;
+        /// PFXfont pointing inside blob (glyph table, bitmap...), valid as long as blob is not touched
+        bool            getFont(PFXfont &font) const
+                        {return blob.size() && !pfxBlobLoad(blob.data(),blob.size(),&font);}
+};
+
+/**
+ * 
+ */
+class FcResult
+{
+public:
+                        FcResult() {status=FC_OK;}
+        FcStatus        status;
+        std::string     error;  // empty when status is FC_OK
+        std::string     header; // the generated C header, all variants
+        std::vector<FcFont> fonts;
+};
+
+FcStatus    fcConvert(FontJob &job, const uint8_t *font, int fontSize, FcResult &result);
+FcStatus    fcConvertFile(FontJob &job, FcResult &result);
+const char *fcStatusName(FcStatus status);
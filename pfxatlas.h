@@ -0,0 +1,44 @@
+// Glyph atlas written by flatconvert --atlas
+// The glyphs are packed into pages of fixed width, 8 or 4 bits per pixel,
+// each row of a page starting on a 16 or 32 bytes boundary so that
+// software compositors can blit rectangles with aligned SIMD loads.
+// The PFXfont is still emitted for the metrics and the code point lookup,
+// its bitmap is NULL : the pixels are only in the atlas.
+
+#pragma once
+#include <stdint.h>
+#include "pfxfont.h"
+
+/// Where a glyph is in the atlas
+typedef struct {
+  uint16_t x;      ///< Top left pixel in the page, even at 4 bpp
+  uint16_t y;
+  uint8_t width;   ///< Same as the PFXglyph
+  uint8_t height;
+  uint16_t page;   ///< Page index
+} PFXatlasRect;
+
+typedef struct {
+  const uint8_t *pixels;     ///< nbPages pages of height * stride bytes
+  const PFXatlasRect *rects; ///< One per entry of font->glyph, empty glyphs have a zero rect
+  const PFXfont *font;       ///< Metrics & lookup
+  uint16_t width;            ///< Page width in pixels
+  uint16_t height;           ///< Page height in pixels
+  uint16_t stride;           ///< Bytes from one row to the next
+  uint8_t bpp;               ///< 8, or 4 with the left pixel in the high nibble
+  uint8_t nbPages;
+} PFXatlas;
+
+/// Rectangle of a code point, NULL if the font does not have it
+static inline const PFXatlasRect *pfxAtlasRect(const PFXatlas *atlas, uint32_t code)
+{
+  const PFXglyph *glyph = pfxGetGlyph(atlas->font, code);
+  return glyph ? atlas->rects + (glyph - atlas->font->glyph) : 0;
+}
+
+/// First byte of row #row of a glyph
+static inline const uint8_t *pfxAtlasRow(const PFXatlas *atlas, const PFXatlasRect *rect, int row)
+{
+  uint32_t y = (uint32_t)rect->page * atlas->height + rect->y + row;
+  return atlas->pixels + y * atlas->stride + ((rect->x * atlas->bpp) >> 3);
+}
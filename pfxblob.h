@@ -0,0 +1,126 @@
+// Binary font container written by flatconvert --blob
+// The blob is used in place : map it from XIP flash or load it once
+// in RAM, pfxBlobLoad() then points a PFXfont inside it, nothing is copied.
+//
+// Layout, little endian, every section starts on a 4 bytes boundary :
+//   PFXblobHeader
+//   glyphs        PFXglyph[nbGlyphs]
+//   ranges        PFXrange[nbRanges]       (sparse fonts)
+//   offset bases  uint32_t[nbOffsetBases]  (fonts over 64 kB)
+//   dictionary    uint8_t[dictionarySize]  (dictionary compression)
+//   kerning       uint32_t[nbKerning] pairs then int8_t[nbKerning] values (kerned fonts)
+//   bitmap        uint8_t[bitmapSize]
+// Unused sections have a zero offset and size.
+
+#pragma once
+#include <stdint.h>
+#include "pfxfont.h"
+
+#define PFX_BLOB_MAGIC   0x42584650 ///< "PFXB"
+#define PFX_BLOB_VERSION 1
+
+typedef struct {
+  uint32_t magic;            ///< PFX_BLOB_MAGIC
+  uint16_t version;          ///< PFX_BLOB_VERSION
+  uint16_t headerSize;       ///< sizeof(PFXblobHeader) when written, newer versions only append fields
+  uint32_t totalSize;        ///< Whole blob
+  uint32_t first;            ///< First code point
+  uint32_t last;             ///< Last code point
+  uint8_t yAdvance;
+  uint8_t bpp;
+  uint8_t shrinked;
+  uint8_t hsWindow;
+  uint8_t hsLookahead;
+  uint8_t offsetBlockShift;
+  uint8_t rotation;          ///< PFX_ROTATE_xxx
+  uint8_t reserved;
+  uint32_t glyphOffset;      ///< Offsets are from the start of the blob
+  uint32_t nbGlyphs;
+  uint32_t rangeOffset;
+  uint32_t nbRanges;
+  uint32_t offsetBaseOffset;
+  uint32_t nbOffsetBases;
+  uint32_t dictionaryOffset;
+  uint32_t dictionarySize;
+  uint32_t bitmapOffset;
+  uint32_t bitmapSize;
+  uint32_t kerningOffset;    ///< Appended fields, only there when headerSize covers them
+  uint32_t nbKerning;
+} PFXblobHeader;
+
+#define PFX_BLOB_HEADER_V1_SIZE 68 ///< Header without kerning
+
+/// Section inside the blob, written so that it cannot overflow
+static inline int pfxBlobSectionOk(uint32_t offset, uint32_t count, uint32_t itemSize, uint32_t total)
+{
+  return offset <= total && count <= (total - offset) / itemSize;
+}
+
+/// Check the blob and fill font with pointers into it
+/// The blob must be 4 bytes aligned. Blobs may come from an SD card or external flash :
+/// besides the section bounds, the index is checked so that no code point lookup can
+/// read past the glyph, range or offset base arrays
+/// Returns 0 on success, -1 if the blob is not valid
+static inline int pfxBlobLoad(const void *blob, uint32_t size, PFXfont *font)
+{
+  const PFXblobHeader *h = (const PFXblobHeader *)blob;
+  uint8_t *base = (uint8_t *)blob;
+  const PFXrange *ranges;
+  uint32_t nbKerning, kerningOffset, i;
+  if (((uintptr_t)blob & 3) || size < PFX_BLOB_HEADER_V1_SIZE)
+    return -1;
+  if (h->magic != PFX_BLOB_MAGIC || h->version != PFX_BLOB_VERSION || h->headerSize < PFX_BLOB_HEADER_V1_SIZE)
+    return -1;
+  if (h->totalSize > size)
+    return -1;
+  if (!pfxBlobSectionOk(h->glyphOffset, h->nbGlyphs, sizeof(PFXglyph), h->totalSize) ||
+      !pfxBlobSectionOk(h->rangeOffset, h->nbRanges, sizeof(PFXrange), h->totalSize) ||
+      !pfxBlobSectionOk(h->offsetBaseOffset, h->nbOffsetBases, sizeof(uint32_t), h->totalSize) ||
+      !pfxBlobSectionOk(h->dictionaryOffset, h->dictionarySize, 1, h->totalSize) ||
+      !pfxBlobSectionOk(h->bitmapOffset, h->bitmapSize, 1, h->totalSize))
+    return -1;
+  nbKerning = (h->headerSize >= sizeof(PFXblobHeader)) ? h->nbKerning : 0;
+  kerningOffset = nbKerning ? h->kerningOffset : 0;
+  if (nbKerning && !pfxBlobSectionOk(kerningOffset, nbKerning, sizeof(uint32_t) + 1, h->totalSize))
+    return -1;
+  if ((h->glyphOffset | h->rangeOffset | h->offsetBaseOffset | h->dictionaryOffset | h->bitmapOffset | kerningOffset) & 3)
+    return -1;
+  // PFXfont fields are 16 bits
+  if (h->nbRanges > 0xFFFF || h->dictionarySize > 0xFFFF)
+    return -1;
+  ranges = (const PFXrange *)(base + h->rangeOffset);
+  if (!h->nbRanges) {
+    // direct index : every code point from first to last has an entry
+    if (h->first > h->last || h->last > 0xFFFF || h->last - h->first + 1 > h->nbGlyphs)
+      return -1;
+  } else {
+    for (i = 0; i < h->nbRanges; i++)
+      if ((uint32_t)ranges[i].glyphIndex + ranges[i].count > h->nbGlyphs)
+        return -1;
+  }
+  if (h->nbOffsetBases) {
+    // one base per block of glyphs
+    if (h->offsetBlockShift > 31 || !h->nbGlyphs || ((h->nbGlyphs - 1) >> h->offsetBlockShift) >= h->nbOffsetBases)
+      return -1;
+  }
+  font->bitmap = base + h->bitmapOffset;
+  font->glyph = (PFXglyph *)(base + h->glyphOffset);
+  font->first = h->first > 0xFFFF ? 0xFFFF : h->first;
+  font->last = h->last > 0xFFFF ? 0xFFFF : h->last;
+  font->yAdvance = h->yAdvance;
+  font->bpp = h->bpp;
+  font->shrinked = h->shrinked;
+  font->ranges = h->nbRanges ? (PFXrange *)(base + h->rangeOffset) : 0;
+  font->nbRanges = h->nbRanges;
+  font->dictionary = h->dictionarySize ? base + h->dictionaryOffset : 0;
+  font->dictionarySize = h->dictionarySize;
+  font->hsWindow = h->hsWindow;
+  font->hsLookahead = h->hsLookahead;
+  font->offsetBase = h->nbOffsetBases ? (uint32_t *)(base + h->offsetBaseOffset) : 0;
+  font->offsetBlockShift = h->offsetBlockShift;
+  font->rotation = h->rotation;
+  font->kerning = nbKerning ? (uint32_t *)(base + kerningOffset) : 0;
+  font->kerningValue = nbKerning ? (int8_t *)(base + kerningOffset + 4 * nbKerning) : 0;
+  font->nbKerning = nbKerning;
+  return 0;
+}
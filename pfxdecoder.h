@@ -0,0 +1,268 @@
+// Reference decoders for the glyph bitmaps produced by flatconvert.
+// Plain C, no allocation, meant to be used as is on the MCU side.
+// A glyph is always decoded in full, into a buffer of
+// pfxGlyphSize() bytes, (width*height*bpp+7)/8 for grey level fonts.
+
+#pragma once
+#include "pfxfont.h"
+
+/// Optional decode counters, pass NULL on the device
+typedef struct {
+  uint32_t bitsRead;    ///< Bits pulled from the compressed stream
+  uint32_t literals;    ///< Literal bytes
+  uint32_t backRefs;    ///< Back references
+  uint32_t bytesCopied; ///< Bytes produced by back references
+  uint32_t runs;        ///< RLE runs
+  uint32_t bytesRead;   ///< Bytes of glyph data read
+  uint32_t bytesOut;    ///< Decoded bytes
+  uint32_t pixelsWritten; ///< Pixels drawn by pfxrender.h
+  uint32_t glyphs;      ///< Glyphs decoded
+} PFXdecodeStats;
+
+/// Pixel #index of a packed bitmap, pixels are MSB first with no padding between rows
+static inline int pfxPackedPixel(const uint8_t *data, int index, int bpp)
+{
+  int bit = index * bpp;
+  return (data[bit >> 3] >> (8 - bpp - (bit & 7))) & ((1 << bpp) - 1);
+}
+
+/// Same thing the other way around, data must be zeroed first
+static inline void pfxPutPixel(uint8_t *data, int index, int bpp, int value)
+{
+  int bit = index * bpp;
+  data[bit >> 3] |= (uint8_t)(value << (8 - bpp - (bit & 7)));
+}
+
+/// Pixel x,y of a PFX_FORMAT_PAGE bitmap
+static inline int pfxPagePixel(const uint8_t *data, int width, int x, int y)
+{
+  return (data[(y >> 3) * width + x] >> (y & 7)) & 1;
+}
+
+/// Decoded size of a glyph, bpp being PFXfont::bpp
+static inline int pfxGlyphSize(const PFXglyph *glyph, int bpp)
+{
+  switch (bpp) {
+    case PFX_FORMAT_PAGE:   return glyph->width * ((glyph->height + 7) >> 3);
+    case PFX_FORMAT_RGB332: return glyph->width * glyph->height;
+    case PFX_FORMAT_RGB565: return glyph->width * glyph->height * 2;
+    default:                return (glyph->width * glyph->height * bpp + 7) >> 3;
+  }
+}
+
+/// MSB first bit reader
+typedef struct {
+  const uint8_t *in;
+  const uint8_t *end;
+  uint8_t current;
+  uint8_t mask;
+} PFXbitReader;
+
+static inline void pfxBitReaderInit(PFXbitReader *r, const uint8_t *in, int size)
+{
+  r->in = in;
+  r->end = in + size;
+  r->current = 0;
+  r->mask = 0;
+}
+
+/// Returns -1 when the stream is exhausted
+static inline int pfxReadBits(PFXbitReader *r, int count)
+{
+  int v = 0;
+  while (count--) {
+    if (!r->mask) {
+      if (r->in >= r->end)
+        return -1;
+      r->current = *r->in++;
+      r->mask = 0x80;
+    }
+    v = (v << 1) | ((r->current & r->mask) ? 1 : 0);
+    r->mask >>= 1;
+  }
+  return v;
+}
+
+/// Heatshrink bitstream decoder, windowBits/lookaheadBits as given to the encoder
+/// Like heatshrink, the window starts zeroed : back references going before the
+/// start of the glyph read 0. When dict is not NULL, they read from the end of the
+/// dictionary first (PFX_SHRINK_DICTIONARY fonts), then 0 before it
+/// Returns the number of bytes written, -1 on a corrupted stream
+static inline int pfxDecodeHeatshrink(const uint8_t *in, int inSize, uint8_t *out, int outSize,
+                                      int windowBits, int lookaheadBits,
+                                      const uint8_t *dict, int dictSize,
+                                      PFXdecodeStats *stats)
+{
+  PFXbitReader r;
+  int o = 0;
+  pfxBitReaderInit(&r, in, inSize);
+  while (o < outSize) {
+    int tag = pfxReadBits(&r, 1);
+    if (tag < 0)
+      return -1;
+    if (tag) { // literal
+      int c = pfxReadBits(&r, 8);
+      if (c < 0)
+        return -1;
+      out[o++] = (uint8_t)c;
+      if (stats) {
+        stats->bitsRead += 9;
+        stats->literals++;
+      }
+      continue;
+    }
+    int index = pfxReadBits(&r, windowBits);
+    int count = pfxReadBits(&r, lookaheadBits);
+    if (index < 0 || count < 0)
+      return -1;
+    index++;
+    count++;
+    if (o + count > outSize)
+      return -1;
+    if (stats) {
+      stats->bitsRead += 1 + windowBits + lookaheadBits;
+      stats->backRefs++;
+      stats->bytesCopied += count;
+    }
+    while (count--) {
+      int src = o - index;
+      out[o++] = (src >= 0) ? out[src] : (src >= -dictSize) ? dict[dictSize + src] : 0;
+    }
+  }
+  if (stats)
+    stats->bytesRead += (uint32_t)(r.in - in);
+  return o;
+}
+
+/// Row run lengths : runs never cross a row, each run is one byte
+/// value << (8 - bpp) | (length - 1), i.e. up to 128/64/16 pixels at 1/2/4 bpp.
+/// 8 bpp runs are two bytes : value, length - 1
+/// The output is the usual packed bitmap.
+/// Returns the number of bytes written, -1 on a corrupted stream
+static inline int pfxDecodeRle(const uint8_t *in, int inSize, uint8_t *out,
+                               int width, int height, int bpp, PFXdecodeStats *stats)
+{
+  const uint8_t *end = in + inSize;
+  int outSize = (width * height * bpp + 7) >> 3;
+  int i, y;
+  for (i = 0; i < outSize; i++)
+    out[i] = 0;
+  for (y = 0; y < height; y++) {
+    int x = 0;
+    while (x < width) {
+      int value, length;
+      if (in >= end)
+        return -1;
+      if (bpp == 8) {
+        if (in + 1 >= end)
+          return -1;
+        value = in[0];
+        length = in[1] + 1;
+        in += 2;
+      } else {
+        value = *in >> (8 - bpp);
+        length = (*in & ((1 << (8 - bpp)) - 1)) + 1;
+        in++;
+      }
+      if (x + length > width)
+        return -1;
+      if (stats)
+        stats->runs++;
+      if (value) {
+        int index = y * width + x;
+        for (i = 0; i < length; i++)
+          pfxPutPixel(out, index + i, bpp, value);
+      }
+      x += length;
+    }
+  }
+  if (stats)
+    stats->bytesRead += (uint32_t)(inSize - (end - in));
+  return outSize;
+}
+
+/// Decode the stored pixels of a glyph, whatever the encoding, ignoring PFX_GLYPH_ROW_GAP
+/// Returns the number of bytes written, -1 on error
+static inline int pfxDecodeGlyphData(const PFXfont *font, const PFXglyph *glyph, const uint8_t *data,
+                                     uint8_t *out, PFXdecodeStats *stats)
+{
+  int bpp = font->bpp;
+  int size = pfxGlyphSize(glyph, bpp);
+  // compressed data is never more than 9 bits per byte, plus the padding
+  int maxIn = size + (size >> 3) + 2;
+  int encoding, got;
+  switch (font->shrinked) {
+    case PFX_SHRINK_HEATSHRINK: encoding = PFX_GLYPH_HEATSHRINK; break;
+    case PFX_SHRINK_DICTIONARY: encoding = PFX_GLYPH_DICTIONARY; break;
+    case PFX_SHRINK_ADAPTIVE:   encoding = glyph->flags & PFX_GLYPH_ENCODING_MASK; break;
+    default:                    encoding = PFX_GLYPH_RAW; break;
+  }
+  switch (encoding) {
+    case PFX_GLYPH_RLE:
+      if (bpp & PFX_FORMAT_NATIVE) // runs are grey levels only
+        return -1;
+      got = pfxDecodeRle(data, 2 * glyph->width * glyph->height + 2, out,
+                         glyph->width, glyph->height, bpp, stats);
+      break;
+    case PFX_GLYPH_HEATSHRINK:
+      got = pfxDecodeHeatshrink(data, maxIn, out, size, pfxWindowBits(font), pfxLookaheadBits(font),
+                                0, 0, stats);
+      break;
+    case PFX_GLYPH_DICTIONARY:
+      got = pfxDecodeHeatshrink(data, maxIn, out, size, pfxWindowBits(font), pfxLookaheadBits(font),
+                                font->dictionary, font->dictionarySize, stats);
+      break;
+    default: {
+      int i;
+      for (i = 0; i < size; i++)
+        out[i] = data[i];
+      if (stats) {
+        stats->bytesRead += size;
+        stats->bytesCopied += size;
+      }
+      got = size;
+      break;
+    }
+  }
+  if (stats && got >= 0) {
+    stats->bytesOut += got;
+    stats->glyphs++;
+  }
+  return got;
+}
+
+/// Decode any glyph of any font into out, pfxGlyphSize() bytes
+/// PFX_GLYPH_ROW_GAP glyphs are stored as a glyph without the blank rows, these
+/// are put back in place here
+/// Returns the number of bytes written, -1 on error
+static inline int pfxDecodeGlyph(const PFXfont *font, const PFXglyph *glyph, const uint8_t *data,
+                                 uint8_t *out, PFXdecodeStats *stats)
+{
+  PFXglyph stored;
+  int bpp = font->bpp, w = glyph->width;
+  int start, count, size, dst, tail;
+  if (!(glyph->flags & PFX_GLYPH_ROW_GAP) || (bpp & PFX_FORMAT_NATIVE))
+    return pfxDecodeGlyphData(font, glyph, data, out, stats);
+  start = data[0];
+  count = data[1];
+  if (start + count > glyph->height)
+    return -1;
+  stored = *glyph;
+  stored.height -= count;
+  stored.flags &= ~PFX_GLYPH_ROW_GAP;
+  if (pfxDecodeGlyphData(font, &stored, data + 2, out, stats) < 0)
+    return -1;
+  if (stats)
+    stats->bytesRead += 2;
+  // move the rows below the gap down, from the end, rows above it are already in place
+  for (dst = w * glyph->height - 1; dst >= start * w; dst--) {
+    int bit = dst * bpp, shift = 8 - bpp - (bit & 7);
+    int v = (dst >= (start + count) * w) ? pfxPackedPixel(out, dst - count * w, bpp) : 0;
+    out[bit >> 3] = (uint8_t)((out[bit >> 3] & ~(((1 << bpp) - 1) << shift)) | (v << shift));
+  }
+  size = pfxGlyphSize(glyph, bpp);
+  tail = (w * glyph->height * bpp) & 7;
+  if (tail)
+    out[size - 1] &= (uint8_t)(0xFF << (8 - tail));
+  return size;
+}
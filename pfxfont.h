@@ -14,8 +14,23 @@ typedef struct {
   uint8_t xAdvance;      ///< Distance to advance cursor (x axis)
   int8_t xOffset;        ///< X dist from cursor pos to UL corner
   int8_t yOffset;        ///< Y dist from cursor pos to UL corner
+  uint8_t flags;         ///< PFX_GLYPH_xxx, uses what was padding
 } PFXglyph;
 
+#define PFX_GLYPH_ENCODING_MASK 3 ///< Adaptive fonts : how this glyph is stored
+#define PFX_GLYPH_RAW        0 ///< Packed pixels
+#define PFX_GLYPH_RLE        1 ///< Row run lengths, see pfxdecoder.h
+#define PFX_GLYPH_HEATSHRINK 2 ///< Heatshrink
+#define PFX_GLYPH_DICTIONARY 3 ///< Heatshrink with the font dictionary
+#define PFX_GLYPH_ROW_GAP    4 ///< Grey level fonts : a run of blank rows is left out, the data starts with its first row and length
+
+/// Run of consecutive code points, sparse fonts only
+typedef struct {
+  uint32_t first;      ///< First code point of the run
+  uint16_t count;      ///< Number of code points in the run
+  uint16_t glyphIndex; ///< Index in the glyph array of the first one
+} PFXrange;
+
 /// Data stored for FONT AS A WHOLE
 typedef struct {
   uint8_t *bitmap;  ///< Glyph bitmaps, concatenated
@@ -23,11 +38,100 @@ typedef struct {
   uint16_t first;   ///< ASCII extents (first char)
   uint16_t last;    ///< ASCII extents (last char)
   uint8_t yAdvance; ///< Newline distance (y axis)
-  uint8_t bpp;      ///< bit per pixel, 1 or 4 at the moment
-  uint8_t shrinked; ///< compressed ?
+  uint8_t bpp;      ///< bit per pixel (1,2,4,8) or PFX_FORMAT_xxx
+  uint8_t shrinked; ///< compressed ? see PFX_SHRINK_xxx
+  PFXrange *ranges; ///< Sparse fonts : sorted code point runs, NULL for first..last fonts
+  uint16_t nbRanges;///< Number of runs
+  uint8_t *dictionary;     ///< PFX_SHRINK_DICTIONARY : data preceding every glyph
+  uint16_t dictionarySize; ///< Dictionary size in bytes
+  uint8_t hsWindow;        ///< Heatshrink window bits, 0 means 8
+  uint8_t hsLookahead;     ///< Heatshrink lookahead bits, 0 means 4
+  uint32_t *offsetBase;    ///< Fonts over 64 kB : offset base of each block of glyphs, else NULL
+  uint8_t offsetBlockShift;///< Glyph #i uses offsetBase[i >> offsetBlockShift]
+  uint8_t rotation;        ///< Glyphs pre-rotated clockwise by rotation quarter turns, metrics in panel coordinates
+  uint32_t *kerning;       ///< Sorted pairs of glyph array indices, left << 16 | right, NULL : no kerning
+  int8_t *kerningValue;    ///< Advance adjustment of each pair, in pixels
+  uint32_t nbKerning;      ///< Number of pairs
 } PFXfont;
 
-#define GFXfont PFXfont // compatibility
-#define GFXglyph PFXglyph // compatibility
+/// PFXfont::rotation : the text runs along panel +x, +y, -x, -y, the bitmaps
+/// being rotated the same way so that they can be streamed in the panel scan order
+#define PFX_ROTATE_0   0
+#define PFX_ROTATE_90  1
+#define PFX_ROTATE_180 2
+#define PFX_ROTATE_270 3
+
+/// PFXfont::bpp of display native fonts : the glyphs are stored the way the display
+/// takes them (once decompressed), ready to be sent with DMA. The low bits are the storage
+/// bits per pixel, plain 1/2/4/8 values being the usual packed grey levels.
+#define PFX_FORMAT_NATIVE 0x80 ///< Set for all the formats below
+#define PFX_FORMAT_PAGE   0x81 ///< Monochrome OLED pages (SSD1306, SH1106) : per band of 8 rows, one byte per column, LSB on top
+#define PFX_FORMAT_RGB332 0x88 ///< One RRRGGGBB byte per pixel, colours blended at conversion time
+#define PFX_FORMAT_RGB565 0x90 ///< Two bytes per pixel, big endian as sent over SPI, colours blended at conversion time
 
+#define PFX_SHRINK_NONE       0 ///< Raw packed bitmaps
+#define PFX_SHRINK_HEATSHRINK 1 ///< Heatshrink, see hsWindow/hsLookahead
+#define PFX_SHRINK_DICTIONARY 2 ///< Same bitstream, back references can reach into the dictionary
+#define PFX_SHRINK_ADAPTIVE   3 ///< Each glyph has its own encoding, see PFX_GLYPH_xxx
 
+/// Glyph for a code point, NULL if the font does not have it
+/// first..last fonts : direct index, sparse fonts : binary search in the runs
+static inline const PFXglyph *pfxGetGlyph(const PFXfont *font, uint32_t code)
+{
+  if (!font->ranges) {
+    if (code < font->first || code > font->last)
+      return 0;
+    return font->glyph + (code - font->first);
+  }
+  int lo = 0, hi = (int)font->nbRanges - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) >> 1;
+    const PFXrange *r = font->ranges + mid;
+    if (code < r->first)
+      hi = mid - 1;
+    else if (code >= r->first + r->count)
+      lo = mid + 1;
+    else
+      return font->glyph + r->glyphIndex + (code - r->first);
+  }
+  return 0;
+}
+
+/// Heatshrink parameters the font was compressed with
+static inline int pfxWindowBits(const PFXfont *font) { return font->hsWindow ? font->hsWindow : 8; }
+static inline int pfxLookaheadBits(const PFXfont *font) { return font->hsLookahead ? font->hsLookahead : 4; }
+
+/// Start of the bitmap of a glyph, bitmapOffset being relative to its block for large fonts
+static inline const uint8_t *pfxGlyphBitmap(const PFXfont *font, const PFXglyph *glyph)
+{
+  uint32_t offset = glyph->bitmapOffset;
+  if (font->offsetBase)
+    offset += font->offsetBase[(glyph - font->glyph) >> font->offsetBlockShift];
+  return font->bitmap + offset;
+}
+
+/// Advance adjustment between two glyphs of the font, in pixels, 0 if the pair is not kerned
+/// Binary search on the pairs, about log2(nbKerning) steps
+static inline int pfxKerning(const PFXfont *font, const PFXglyph *left, const PFXglyph *right)
+{
+  uint32_t key;
+  int lo = 0, hi;
+  if (!font->kerning || !left || !right)
+    return 0;
+  key = ((uint32_t)(left - font->glyph) << 16) | (uint32_t)(right - font->glyph);
+  hi = (int)font->nbKerning - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) >> 1;
+    uint32_t k = font->kerning[mid];
+    if (k < key)
+      lo = mid + 1;
+    else if (k > key)
+      hi = mid - 1;
+    else
+      return font->kerningValue[mid];
+  }
+  return 0;
+}
+
+#define GFXfont PFXfont // compatibility
+#define GFXglyph PFXglyph // compatibility
@@ -0,0 +1,157 @@
+// Reference renderer on top of pfxdecoder.h : draws glyphs and UTF-8 strings
+// into an 8 bits per pixel framebuffer.
+// Plain C, no allocation, the caller gives a scratch buffer of
+// pfxMaxGlyphSize() bytes the glyphs are decoded into.
+// Pixels are scaled to 0..255, blank pixels leave the background alone,
+// everything is clipped to the framebuffer. PFX_FORMAT_PAGE fonts are drawn
+// too, RGB fonts are not : their decoded glyphs go to the display as is.
+// With a PFXdecodeStats, the decode counters plus the pixels written are
+// gathered, flatconvert uses them for the cost estimate of the footer.
+
+#pragma once
+#include "pfxdecoder.h"
+
+/// 8 bits per pixel, row after row
+typedef struct {
+  uint8_t *pixels;
+  int width;
+  int height;
+  int stride; ///< Bytes from one row to the next
+} PFXframebuffer;
+
+/// Number of entries of the glyph array
+static inline int pfxNbGlyphs(const PFXfont *font)
+{
+  if (!font->ranges)
+    return font->last - font->first + 1;
+  if (!font->nbRanges)
+    return 0;
+  return font->ranges[font->nbRanges - 1].glyphIndex + font->ranges[font->nbRanges - 1].count;
+}
+
+/// Scratch buffer needed by pfxDrawGlyph/pfxDrawString, in bytes
+static inline int pfxMaxGlyphSize(const PFXfont *font)
+{
+  int i, nb = pfxNbGlyphs(font), max = 0;
+  for (i = 0; i < nb; i++) {
+    int size = pfxGlyphSize(font->glyph + i, font->bpp);
+    if (size > max)
+      max = size;
+  }
+  return max;
+}
+
+/// Next code point of a UTF-8 string, *s is moved past it
+/// Returns 0 at the end of the string, 0xFFFD on an invalid sequence
+static inline uint32_t pfxUtf8Next(const char **s)
+{
+  const uint8_t *p = (const uint8_t *)*s;
+  uint32_t c = *p;
+  int extra, i;
+  if (!c)
+    return 0;
+  p++;
+  if (c < 0x80)
+    extra = 0;
+  else if ((c & 0xE0) == 0xC0) {
+    c &= 0x1F;
+    extra = 1;
+  } else if ((c & 0xF0) == 0xE0) {
+    c &= 0x0F;
+    extra = 2;
+  } else if ((c & 0xF8) == 0xF0) {
+    c &= 0x07;
+    extra = 3;
+  } else {
+    *s = (const char *)p;
+    return 0xFFFD;
+  }
+  for (i = 0; i < extra; i++) {
+    if ((*p & 0xC0) != 0x80) { // truncated, resume on that byte
+      *s = (const char *)p;
+      return 0xFFFD;
+    }
+    c = (c << 6) | (*p++ & 0x3F);
+  }
+  *s = (const char *)p;
+  return c;
+}
+
+/// Draw a glyph, the cursor (on the baseline) being at x,y
+/// Returns 0, -1 if the glyph does not decode or the font is RGB
+static inline int pfxDrawGlyph(const PFXfont *font, const PFXglyph *glyph, PFXframebuffer *fb,
+                               int x, int y, uint8_t *scratch, PFXdecodeStats *stats)
+{
+  int w = glyph->width, h = glyph->height, bpp = font->bpp;
+  int page = (bpp == PFX_FORMAT_PAGE);
+  int max, row, col;
+  if ((bpp & PFX_FORMAT_NATIVE) && !page)
+    return -1;
+  max = page ? 1 : (1 << bpp) - 1;
+  if (!w || !h)
+    return 0;
+  if (pfxDecodeGlyph(font, glyph, pfxGlyphBitmap(font, glyph), scratch, stats) < 0)
+    return -1;
+  x += glyph->xOffset;
+  y += glyph->yOffset;
+  for (row = 0; row < h; row++) {
+    int py = y + row;
+    uint8_t *line;
+    if (py < 0 || py >= fb->height)
+      continue;
+    line = fb->pixels + py * fb->stride;
+    for (col = 0; col < w; col++) {
+      int px = x + col, v;
+      if (px < 0 || px >= fb->width)
+        continue;
+      v = page ? pfxPagePixel(scratch, w, col, row) : pfxPackedPixel(scratch, row * w + col, bpp);
+      if (!v)
+        continue;
+      line[px] = (uint8_t)(v * 255 / max);
+      if (stats)
+        stats->pixelsWritten++;
+    }
+  }
+  return 0;
+}
+
+/// Draw a UTF-8 string, the cursor starting on the baseline at x,y
+/// The cursor moves along the text direction of the font (see PFXfont::rotation), kerned pairs
+/// being moved closer or apart, '\n' goes
+/// back to the start of the line one yAdvance further, code points missing from the font are skipped
+/// Returns the cursor along the text direction at the end (x, y for 90/270 fonts), -1 if a glyph does not decode
+static inline int pfxDrawString(const PFXfont *font, const char *text, PFXframebuffer *fb,
+                                int x, int y, uint8_t *scratch, PFXdecodeStats *stats)
+{
+  static const signed char dirX[4] = {1, 0, -1, 0};
+  static const signed char dirY[4] = {0, 1, 0, -1};
+  int r = font->rotation & 3;
+  int lineX = x, lineY = y;
+  const PFXglyph *previous = 0;
+  uint32_t c;
+  while ((c = pfxUtf8Next(&text)) != 0) {
+    const PFXglyph *glyph;
+    if (c == '\n') { // "down" turned like the text
+      lineX -= dirY[r] * font->yAdvance;
+      lineY += dirX[r] * font->yAdvance;
+      x = lineX;
+      y = lineY;
+      previous = 0;
+      continue;
+    }
+    glyph = pfxGetGlyph(font, c);
+    if (!glyph)
+      continue;
+    if (previous) {
+      int kern = pfxKerning(font, previous, glyph);
+      x += dirX[r] * kern;
+      y += dirY[r] * kern;
+    }
+    previous = glyph;
+    if (pfxDrawGlyph(font, glyph, fb, x, y, scratch, stats) < 0)
+      return -1;
+    x += dirX[r] * glyph->xAdvance;
+    y += dirY[r] * glyph->xAdvance;
+  }
+  return (r & 1) ? y : x;
+}